@@ -0,0 +1,481 @@
+#include "unordered_map.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <span>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace bench {
+
+template <typename T>
+void do_not_optimize(const T& value) {
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+class State {
+public:
+    State(size_t size, float load_factor, size_t max_iterations) : sz(size),
+                                                                   target_load(load_factor),
+                                                                   iteration_limit(max_iterations) {}
+
+    bool keep_running() {
+        if (done_iterations == 0) {
+            resume_timing();
+        }
+        if (done_iterations == iteration_limit) {
+            pause_timing();
+            return false;
+        }
+        ++done_iterations;
+        return true;
+    }
+
+    void pause_timing() {
+        real_time += std::chrono::steady_clock::now() - real_start;
+        cpu_time += std::clock() - cpu_start;
+    }
+
+    void resume_timing() {
+        real_start = std::chrono::steady_clock::now();
+        cpu_start = std::clock();
+    }
+
+    void set_items_processed(size_t items) {
+        processed = items;
+    }
+
+    size_t size() const {
+        return sz;
+    }
+
+    float load_factor() const {
+        return target_load;
+    }
+
+    size_t iterations() const {
+        return done_iterations;
+    }
+
+    size_t items_processed() const {
+        return processed;
+    }
+
+    double real_seconds() const {
+        return std::chrono::duration<double>(real_time).count();
+    }
+
+    double cpu_seconds() const {
+        return static_cast<double>(cpu_time) / CLOCKS_PER_SEC;
+    }
+
+private:
+    size_t sz;
+    float target_load;
+    size_t iteration_limit;
+    size_t done_iterations = 0;
+    size_t processed = 0;
+    std::chrono::steady_clock::time_point real_start;
+    std::chrono::steady_clock::duration real_time{};
+    std::clock_t cpu_start = 0;
+    std::clock_t cpu_time = 0;
+};
+
+struct Benchmark {
+    std::string name;
+    size_t size;
+    float load_factor;
+    std::function<void(State&)> body;
+};
+
+struct Result {
+    std::string name;
+    size_t iterations;
+    double real_ns;
+    double cpu_ns;
+    double items_per_second;
+};
+
+struct ShortString {};
+struct LongString {};
+
+template <typename Tag>
+struct KeyTraits;
+
+template <>
+struct KeyTraits<int> {
+    using type = int;
+    static constexpr std::string_view name = "int";
+
+    // a 32-bit mixer with an inverse, so disjoint index ranges give disjoint keys
+    static type make(uint64_t index) {
+        constexpr int first_shift = 16;
+        constexpr int second_shift = 13;
+        constexpr uint32_t first_multiplier = 0x85ebca6b;
+        constexpr uint32_t second_multiplier = 0xc2b2ae35;
+        auto hash = static_cast<uint32_t>(index);
+        hash ^= hash >> first_shift;
+        hash *= first_multiplier;
+        hash ^= hash >> second_shift;
+        hash *= second_multiplier;
+        hash ^= hash >> first_shift;
+        return static_cast<int>(hash);
+    }
+};
+
+template <>
+struct KeyTraits<uint64_t> {
+    using type = uint64_t;
+    static constexpr std::string_view name = "uint64";
+
+    static type make(uint64_t index) {
+        return detail::hash_mix(index);
+    }
+};
+
+template <>
+struct KeyTraits<ShortString> {
+    using type = std::string;
+    static constexpr std::string_view name = "short_string";
+
+    static type make(uint64_t index) {
+        return "k" + std::to_string(index);
+    }
+};
+
+template <>
+struct KeyTraits<LongString> {
+    using type = std::string;
+    static constexpr std::string_view name = "long_string";
+
+    static type make(uint64_t index) {
+        return "a-long-key-that-defeats-small-string-optimization/" + std::to_string(index);
+    }
+};
+
+template <typename Tag>
+std::vector<typename KeyTraits<Tag>::type> make_keys(size_t count, uint64_t offset) {
+    std::vector<typename KeyTraits<Tag>::type> keys;
+    keys.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+        keys.push_back(KeyTraits<Tag>::make(offset + i));
+    }
+    return keys;
+}
+
+template <typename Map, typename Keys>
+Map build_map(const Keys& keys, float load_factor) {
+    Map map;
+    map.max_load_factor(load_factor);
+    for (const auto& key : keys) {
+        map.emplace(key, 0);
+    }
+    return map;
+}
+
+template <typename Map, typename Tag>
+struct Suite {
+    static void insert(State& state) {
+        auto keys = make_keys<Tag>(state.size(), 0);
+        while (state.keep_running()) {
+            Map map = build_map<Map>(keys, state.load_factor());
+            do_not_optimize(map);
+            state.pause_timing();
+            map = Map();
+            state.resume_timing();
+        }
+        state.set_items_processed(state.iterations() * keys.size());
+    }
+
+    static void find_hit(State& state) {
+        auto keys = make_keys<Tag>(state.size(), 0);
+        const Map map = build_map<Map>(keys, state.load_factor());
+        while (state.keep_running()) {
+            for (const auto& key : keys) {
+                do_not_optimize(map.find(key));
+            }
+        }
+        state.set_items_processed(state.iterations() * keys.size());
+    }
+
+    // probes in blocks the way a hash join does; maps without find_batch fall back to find
+    static void find_batch(State& state) {
+        constexpr size_t batch_size = 1024;
+        auto keys = make_keys<Tag>(state.size(), 0);
+        const Map map = build_map<Map>(keys, state.load_factor());
+        std::vector<typename Map::const_iterator> found(batch_size);
+        while (state.keep_running()) {
+            for (size_t offset = 0; offset < keys.size(); offset += batch_size) {
+                size_t count = std::min(batch_size, keys.size() - offset);
+                std::span<const typename Map::key_type> batch(keys.data() + offset, count);
+                if constexpr (requires { map.find_batch(batch, std::span(found)); }) {
+                    map.find_batch(batch, std::span(found.data(), count));
+                } else {
+                    std::ranges::transform(batch, found.begin(), [&map](const auto& key) { return map.find(key); });
+                }
+                do_not_optimize(found);
+            }
+        }
+        state.set_items_processed(state.iterations() * keys.size());
+    }
+
+    static void find_miss(State& state) {
+        auto keys = make_keys<Tag>(state.size(), 0);
+        auto misses = make_keys<Tag>(state.size(), state.size());
+        const Map map = build_map<Map>(keys, state.load_factor());
+        while (state.keep_running()) {
+            for (const auto& key : misses) {
+                do_not_optimize(map.find(key));
+            }
+        }
+        state.set_items_processed(state.iterations() * misses.size());
+    }
+
+    static void erase(State& state) {
+        auto keys = make_keys<Tag>(state.size(), 0);
+        while (state.keep_running()) {
+            state.pause_timing();
+            Map map = build_map<Map>(keys, state.load_factor());
+            state.resume_timing();
+            for (const auto& key : keys) {
+                map.erase(key);
+            }
+            do_not_optimize(map);
+            state.pause_timing();
+            map = Map();
+            state.resume_timing();
+        }
+        state.set_items_processed(state.iterations() * keys.size());
+    }
+
+    static void iterate(State& state) {
+        const Map map = build_map<Map>(make_keys<Tag>(state.size(), 0), state.load_factor());
+        while (state.keep_running()) {
+            for (const auto& item : map) {
+                do_not_optimize(item.second);
+            }
+        }
+        state.set_items_processed(state.iterations() * map.size());
+    }
+
+    static void rehash(State& state) {
+        Map map = build_map<Map>(make_keys<Tag>(state.size(), 0), state.load_factor());
+        size_t buckets = map.bucket_count();
+        while (state.keep_running()) {
+            map.rehash(2 * buckets);
+            map.rehash(buckets);
+            do_not_optimize(map);
+        }
+        state.set_items_processed(2 * state.iterations() * map.size());
+    }
+
+    static void copy(State& state) {
+        const Map map = build_map<Map>(make_keys<Tag>(state.size(), 0), state.load_factor());
+        while (state.keep_running()) {
+            Map copy = map;
+            do_not_optimize(copy);
+            state.pause_timing();
+            copy = Map();
+            state.resume_timing();
+        }
+        state.set_items_processed(state.iterations() * map.size());
+    }
+};
+
+struct Options {
+    std::vector<size_t> sizes = {1'000, 100'000, 1'000'000};
+    std::vector<float> load_factors = {0.5F, 1.0F};
+    std::string filter;
+    double min_time = 0.5;
+    std::string out;
+    bool json = false;
+};
+
+std::string format_float(float value) {
+    std::ostringstream out;
+    out << value;
+    return out.str();
+}
+
+template <typename Map, typename Tag>
+void register_suite(std::vector<Benchmark>& benchmarks, std::string_view map_name, const Options& options) {
+    using Cases = Suite<Map, Tag>;
+    const std::pair<std::string_view, void (*)(State&)> cases[] = {
+        {"insert", &Cases::insert}, {"find_hit", &Cases::find_hit}, {"find_batch", &Cases::find_batch},
+        {"find_miss", &Cases::find_miss},
+        {"erase", &Cases::erase}, {"iterate", &Cases::iterate}, {"rehash", &Cases::rehash}, {"copy", &Cases::copy},
+    };
+    for (auto [case_name, body] : cases) {
+        for (size_t size : options.sizes) {
+            for (float load_factor : options.load_factors) {
+                std::string name = std::string(case_name) + "/" + std::string(map_name) + "<" +
+                                   std::string(KeyTraits<Tag>::name) + ">/size:" + std::to_string(size) +
+                                   "/load_factor:" + format_float(load_factor);
+                if (name.find(options.filter) == std::string::npos) {
+                    continue;
+                }
+                benchmarks.push_back({std::move(name), size, load_factor, body});
+            }
+        }
+    }
+}
+
+template <typename Tag>
+void register_key(std::vector<Benchmark>& benchmarks, const Options& options) {
+    using Key = typename KeyTraits<Tag>::type;
+    register_suite<UnorderedMap<Key, int>, Tag>(benchmarks, "UnorderedMap", options);
+    register_suite<std::unordered_map<Key, int>, Tag>(benchmarks, "std::unordered_map", options);
+}
+
+Result run(const Benchmark& benchmark, double min_time) {
+    constexpr size_t max_iterations = 1'000'000'000;
+    constexpr double growth_limit = 10.0;
+    constexpr double overshoot = 1.4;
+    size_t iterations = 1;
+    while (true) {
+        State state(benchmark.size, benchmark.load_factor, iterations);
+        benchmark.body(state);
+        double elapsed = state.real_seconds();
+        if (elapsed >= min_time || iterations >= max_iterations) {
+            double per_iteration = 1e9 / static_cast<double>(iterations);
+            return {benchmark.name, iterations, elapsed * per_iteration, state.cpu_seconds() * per_iteration,
+                    static_cast<double>(state.items_processed()) / elapsed};
+        }
+        double scale = elapsed > 0 ? std::min(growth_limit, overshoot * min_time / elapsed) : growth_limit;
+        iterations = std::max(iterations + 1, static_cast<size_t>(static_cast<double>(iterations) * scale));
+    }
+}
+
+std::string json_escape(std::string_view text) {
+    std::string result;
+    for (char symbol : text) {
+        if (symbol == '"' || symbol == '\\') {
+            result += '\\';
+        }
+        result += symbol;
+    }
+    return result;
+}
+
+void write_json(std::ostream& out, const std::vector<Result>& results) {
+    out << "{\n  \"context\": {\n";
+    out << "    \"num_cpus\": " << std::thread::hardware_concurrency() << ",\n";
+#ifdef NDEBUG
+    out << "    \"library_build_type\": \"release\"\n";
+#else
+    out << "    \"library_build_type\": \"debug\"\n";
+#endif
+    out << "  },\n  \"benchmarks\": [\n";
+    for (size_t i = 0; i < results.size(); ++i) {
+        const Result& result = results[i];
+        out << "    {\n";
+        out << "      \"name\": \"" << json_escape(result.name) << "\",\n";
+        out << "      \"run_name\": \"" << json_escape(result.name) << "\",\n";
+        out << "      \"run_type\": \"iteration\",\n";
+        out << "      \"iterations\": " << result.iterations << ",\n";
+        out << "      \"real_time\": " << result.real_ns << ",\n";
+        out << "      \"cpu_time\": " << result.cpu_ns << ",\n";
+        out << "      \"time_unit\": \"ns\",\n";
+        out << "      \"items_per_second\": " << result.items_per_second << "\n";
+        out << "    }" << (i + 1 == results.size() ? "\n" : ",\n");
+    }
+    out << "  ]\n}\n";
+}
+
+void write_console(std::ostream& out, const Result& result) {
+    constexpr int name_width = 72;
+    constexpr int time_width = 14;
+    out << std::left << std::setw(name_width) << result.name << std::right
+        << std::setw(time_width) << std::fixed << std::setprecision(0) << result.real_ns << " ns"
+        << std::setw(time_width) << result.cpu_ns << " ns"
+        << std::setw(time_width) << result.iterations
+        << std::setw(time_width) << std::setprecision(3) << result.items_per_second / 1e6 << "M items/s\n"
+        << std::flush;
+}
+
+template <typename T, typename Parse>
+std::vector<T> parse_list(std::string_view text, Parse parse) {
+    std::vector<T> result;
+    while (!text.empty()) {
+        size_t comma = text.find(',');
+        result.push_back(parse(std::string(text.substr(0, comma))));
+        text.remove_prefix(comma == std::string_view::npos ? text.size() : comma + 1);
+    }
+    return result;
+}
+
+Options parse_options(int argc, char** argv) {
+    Options options;
+    for (int i = 1; i < argc; ++i) {
+        std::string_view arg = argv[i];
+        auto value = [arg](std::string_view flag) -> std::optional<std::string_view> {
+            if (arg.substr(0, flag.size()) != flag) {
+                return std::nullopt;
+            }
+            return arg.substr(flag.size());
+        };
+        if (auto sizes = value("--sizes=")) {
+            options.sizes = parse_list<size_t>(*sizes, [](const std::string& item) { return std::stoull(item); });
+        } else if (auto factors = value("--load_factors=")) {
+            options.load_factors = parse_list<float>(*factors, [](const std::string& item) { return std::stof(item); });
+        } else if (auto filter = value("--benchmark_filter=")) {
+            options.filter = *filter;
+        } else if (auto min_time = value("--benchmark_min_time=")) {
+            options.min_time = std::stod(std::string(*min_time));
+        } else if (auto out = value("--benchmark_out=")) {
+            options.out = *out;
+        } else if (auto format = value("--benchmark_format=")) {
+            options.json = *format == "json";
+        } else {
+            throw std::invalid_argument("Unknown option: " + std::string(arg));
+        }
+    }
+    return options;
+}
+
+}  // namespace bench
+
+int main(int argc, char** argv) {
+    bench::Options options;
+    try {
+        options = bench::parse_options(argc, argv);
+    } catch (const std::exception& error) {
+        std::cerr << error.what() << "\n"
+                  << "usage: " << argv[0] << " [--sizes=1000,100000] [--load_factors=0.5,1]"
+                  << " [--benchmark_filter=substring] [--benchmark_min_time=seconds]"
+                  << " [--benchmark_out=file.json] [--benchmark_format=console|json]\n";
+        return 1;
+    }
+
+    std::vector<bench::Benchmark> benchmarks;
+    bench::register_key<int>(benchmarks, options);
+    bench::register_key<uint64_t>(benchmarks, options);
+    bench::register_key<bench::ShortString>(benchmarks, options);
+    bench::register_key<bench::LongString>(benchmarks, options);
+
+    std::vector<bench::Result> results;
+    std::ostream& console = options.json ? std::cerr : std::cout;
+    for (const auto& benchmark : benchmarks) {
+        results.push_back(bench::run(benchmark, options.min_time));
+        bench::write_console(console, results.back());
+    }
+
+    if (options.json) {
+        bench::write_json(std::cout, results);
+    }
+    if (!options.out.empty()) {
+        std::ofstream out(options.out);
+        bench::write_json(out, results);
+    }
+    return 0;
+}
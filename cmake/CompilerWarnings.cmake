@@ -81,4 +81,10 @@ function(set_project_warnings project_name)
 
   target_compile_options(${project_name} INTERFACE ${PROJECT_WARNINGS} -g)
 
+  # once erase(find(key)) and similar calls are inlined, gcc reports -Wnull-dereference on the end()
+  # path that the callers already rule out; keep the check in Debug builds, where it has no false positives
+  if(CMAKE_CXX_COMPILER_ID STREQUAL "GNU")
+    target_compile_options(${project_name} INTERFACE $<$<NOT:$<CONFIG:Debug>>:-Wno-null-dereference>)
+  endif()
+
 endfunction()
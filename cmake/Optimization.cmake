@@ -0,0 +1,54 @@
+function(enable_optimizations project_name)
+
+  if(CMAKE_CXX_COMPILER_ID STREQUAL "GNU" OR CMAKE_CXX_COMPILER_ID MATCHES ".*Clang")
+    option(ENABLE_LTO "Enable link time optimization" FALSE)
+    if(ENABLE_LTO)
+      include(CheckIPOSupported)
+      check_ipo_supported(RESULT LTO_SUPPORTED OUTPUT LTO_ERROR LANGUAGES CXX)
+      if(NOT LTO_SUPPORTED)
+        message(WARNING "Link time optimization is not supported: ${LTO_ERROR}")
+      elseif(CMAKE_CXX_COMPILER_ID STREQUAL "GNU")
+        target_compile_options(${project_name} INTERFACE -flto=auto)
+        target_link_libraries(${project_name} INTERFACE -flto=auto)
+      else()
+        target_compile_options(${project_name} INTERFACE -flto=thin)
+        target_link_libraries(${project_name} INTERFACE -flto=thin)
+      endif()
+    endif()
+
+    option(ENABLE_NATIVE_ARCH "Tune code for the instruction set of the build machine" FALSE)
+    if(ENABLE_NATIVE_ARCH)
+      target_compile_options(${project_name} INTERFACE -march=native)
+    endif()
+
+    set(PGO_MODE
+        "OFF"
+        CACHE STRING "Profile guided optimization stage: OFF, GENERATE or USE")
+    set_property(CACHE PGO_MODE PROPERTY STRINGS OFF GENERATE USE)
+    set(PGO_PROFILE_DIR
+        "${CMAKE_SOURCE_DIR}/pgo-profile"
+        CACHE PATH "Directory the instrumented binaries write profiles to")
+
+    # gcc names profiles after the object path, so strip the build directory to let
+    # the instrumented and the optimized build live in different directories
+    if(CMAKE_CXX_COMPILER_ID STREQUAL "GNU")
+      set(PGO_PATH_FLAGS -fprofile-prefix-path=${CMAKE_BINARY_DIR})
+    endif()
+
+    if(PGO_MODE STREQUAL "GENERATE")
+      target_compile_options(${project_name} INTERFACE -fprofile-generate=${PGO_PROFILE_DIR} ${PGO_PATH_FLAGS})
+      target_link_libraries(${project_name} INTERFACE -fprofile-generate=${PGO_PROFILE_DIR})
+    elseif(PGO_MODE STREQUAL "USE")
+      if(CMAKE_CXX_COMPILER_ID STREQUAL "GNU")
+        set(PGO_USE_FLAGS -fprofile-use=${PGO_PROFILE_DIR} ${PGO_PATH_FLAGS} -fprofile-correction)
+      else()
+        set(PGO_USE_FLAGS -fprofile-use=${PGO_PROFILE_DIR}/default.profdata -Wno-profile-instr-unprofiled)
+      endif()
+      target_compile_options(${project_name} INTERFACE ${PGO_USE_FLAGS})
+      target_link_libraries(${project_name} INTERFACE ${PGO_USE_FLAGS})
+    elseif(NOT PGO_MODE STREQUAL "OFF")
+      message(FATAL_ERROR "PGO_MODE must be OFF, GENERATE or USE, got ${PGO_MODE}")
+    endif()
+  endif()
+
+endfunction()
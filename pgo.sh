@@ -0,0 +1,38 @@
+#!/bin/bash
+
+# Builds an instrumented benchmark, trains it on the benchmark suite and
+# rebuilds everything with the collected profile. Extra arguments are passed
+# to the training run, e.g. ./pgo.sh --benchmark_filter=UnorderedMap
+
+profile_dir="build-pgo-profile"
+training_args="--sizes=1000,100000 --load_factors=0.5,1 --benchmark_min_time=0.05"
+
+rm -rf "$profile_dir"
+
+echo "Building instrumented benchmark..."
+if ! (cmake --preset pgo-generate $CMAKE_ARGS && cmake --build --preset pgo-generate --parallel "$(nproc)"); then
+    echo "instrumented build failed!"
+    exit 1
+fi
+
+echo "Training on the benchmark suite..."
+if ! ./build-pgo-generate/unordered_map_bench $training_args "$@" > /dev/null; then
+    echo "training run failed!"
+    exit 2
+fi
+
+if ls "$profile_dir"/*.profraw > /dev/null 2>&1; then
+    echo "Merging clang profiles..."
+    if ! llvm-profdata merge -output="$profile_dir/default.profdata" "$profile_dir"/*.profraw; then
+        echo "llvm-profdata failed!"
+        exit 3
+    fi
+fi
+
+echo "Building with profile..."
+if ! (cmake --preset pgo-use $CMAKE_ARGS && cmake --build --preset pgo-use --parallel "$(nproc)"); then
+    echo "optimized build failed!"
+    exit 4
+fi
+
+echo "build ready: ./build-pgo-use/unordered_map_bench"
@@ -6,6 +6,10 @@
 #include <ranges>
 #include <compare>
 #include <numeric>
+#include <string_view>
+#include <thread>
+#include <atomic>
+#include <latch>
 
 
 using testing::make_test;
@@ -46,6 +50,46 @@ struct NotDefaultConstructible {
     auto operator<=>(const NotDefaultConstructible&) const = default;
 };
 
+struct StringHash {
+    using is_transparent = void;
+    size_t operator()(std::string_view str) const {
+        return std::hash<std::string_view>{}(str);
+    }
+};
+
+struct ClusteringHash {
+    size_t operator()(int key) const {
+        return size_t(key % 4);
+    }
+};
+
+struct IdentityHash {
+    size_t operator()(int key) const {
+        return size_t(key);
+    }
+};
+
+struct FragileCopy {
+    static inline bool fail = false;
+    int data;
+
+    FragileCopy(int input): data(input) {}
+    FragileCopy(const FragileCopy& other): data(other.data) {
+        if (fail) {
+            throw std::runtime_error("copy failed");
+        }
+    }
+    FragileCopy& operator=(const FragileCopy&) = default;
+};
+
+struct CountingEqual {
+    static inline size_t calls = 0;
+    bool operator()(int lhs, int rhs) const {
+        ++calls;
+        return lhs == rhs;
+    }
+};
+
 const size_t small_size = 17;
 const size_t medium_size = 100;
 
@@ -113,6 +157,41 @@ TestGroup create_constructor_tests() {
             map.swap(another);
             test.equals(it->second, 1_tr);
             test.equals(address->second, 1_tr);
+            test.check(rng::all_of(iota(0, int(small_size)), [&](int key) { return another.contains(key); }));
+            test.check(!map.contains(1));
+        }),
+
+        make_test<PrettyTest>("copies keep working buckets", [](auto& test){
+            UnorderedMap<std::string, int> map;
+            map.incremental_rehash(1);
+            for (int i = 0; i < int(medium_size); ++i) {
+                map.emplace(std::to_string(i), i);
+            }
+            auto all_found = [](const auto& target) {
+                return rng::all_of(iota(0, int(medium_size)), [&](int key) {
+                    return target.at(std::to_string(key)) == key;
+                });
+            };
+            UnorderedMap<std::string, int> copy = map;
+            test.check(all_found(copy) && copy == map);
+            UnorderedMap<std::string, int> assigned;
+            assigned.emplace("stale", -1);
+            assigned = copy;
+            test.check(all_found(assigned) && !assigned.contains("stale"));
+            UnorderedMap<std::string, int> moved = std::move(copy);
+            test.check(all_found(moved));
+            assigned = std::move(moved);
+            test.check(all_found(assigned) && assigned == map);
+            assigned["0"] = 1;
+            test.check(!(assigned == map));
+
+            map.rehash(medium_size * medium_size);
+            size_t grown = map.bucket_count();
+            map.rehash(0);
+            test.check(map.bucket_count() < grown);
+            map.rehash(grown);
+            test.equals(map.bucket_count(), grown);
+            test.check(all_found(map));
         })
 
     };
@@ -158,6 +237,29 @@ TestGroup create_modification_tests() {
             test.equals(moving_map.at("c"), "a");
         }),
 
+        make_test<PrettyTest>("try_emplace and insert_or_assign", [](auto& test){
+            UnorderedMap<std::string, std::string> map;
+            std::string key = "a";
+            std::string value = "a";
+            auto [place, did_insert] = map.try_emplace(key, std::move(value));
+            test.check(did_insert);
+            test.equals(value, "");
+            value = "b";
+            auto [old_place, reinsert] = map.try_emplace(std::move(key), std::move(value));
+            test.check(!reinsert);
+            test.equals(old_place, place);
+            test.equals(key, "a");
+            test.equals(value, "b");
+            test.equals(map.at("a"), "a");
+
+            auto [assigned, assign_inserted] = map.insert_or_assign("a", std::move(value));
+            test.check(!assign_inserted);
+            test.equals(assigned, place);
+            test.equals(map.at("a"), "b");
+            test.check(map.insert_or_assign("c", "c").second);
+            test.equals(map.size(), 2_sz);
+        }),
+
         make_test<PrettyTest>("insert nontrivial", [](auto& test){
             UnorderedMap<int, NonTrivial> map;
             auto [place, did_insert] = map.insert({1, 1_ntr});
@@ -238,6 +340,134 @@ TestGroup create_modification_tests() {
             test.check(rng::all_of(storage, [&](auto& p) {
                 return test.equals(p.second, "");
             }));
+        }),
+
+        make_test<PrettyTest>("clear", [](auto& test) {
+            UnorderedMap<int, std::string> map;
+            map.incremental_rehash(1);
+            for (int round = 0; round < 3; ++round) {
+                for (int i = 0; i < int(medium_size); ++i) {
+                    map.emplace(i, std::to_string(i + round));
+                }
+                size_t buckets = map.bucket_count();
+                map.clear();
+                test.equals(map.size(), 0_sz);
+                test.equals(map.bucket_count(), buckets);
+                test.check(map.begin() == map.end());
+                test.check(rng::none_of(iota(0, int(medium_size)), [&](int key) { return map.contains(key); }));
+            }
+            map.emplace(1, "1");
+            test.equals(map.at(1), "1");
+            test.equals(size_t(std::distance(map.begin(), map.end())), 1_sz);
+
+            auto trivial = make_small_map<Trivial>();
+            trivial.clear();
+            trivial.clear();
+            test.check(trivial.empty());
+        }),
+
+        make_test<PrettyTest>("node handles", [](auto& test) {
+            UnorderedMap<std::string, int> hot;
+            UnorderedMap<std::string, int> cold;
+            for (int i = 0; i < int(medium_size); ++i) {
+                hot.emplace(std::to_string(i), i);
+            }
+            const int* address = &hot.at("7");
+            auto handle = hot.extract("7");
+            test.check(!handle.empty() && std::as_const(handle).key() == "7" && handle.mapped() == 7);
+            test.check(!hot.contains("7"));
+            auto result = cold.insert(std::move(handle));
+            test.check(result.inserted && result.node.empty() && handle.empty());
+            test.equals(&result.position->second, address);
+            test.check(hot.extract("7").empty());
+
+            for (int i = 0; i < int(medium_size); i += 2) {
+                test.check(cold.insert(hot.extract(hot.find(std::to_string(i)))).inserted);
+            }
+            test.equals(hot.size() + cold.size(), medium_size);
+
+            auto rekeyed = cold.extract("0");
+            rekeyed.key() = "renamed";
+            test.check(std::as_const(rekeyed).key() == "renamed" && rekeyed.mapped() == 0);
+            test.check(cold.insert(std::move(rekeyed)).inserted);
+            test.equals(cold.at("renamed"), 0);
+            test.check(!cold.contains("0"));
+            std::string long_key(medium_size, 'k');
+            auto renamed_again = cold.extract("renamed");
+            renamed_again.key() = long_key;
+            test.check(cold.insert(std::move(renamed_again)).inserted);
+            test.equals(cold.at(long_key), 0);
+
+            auto duplicate = hot.extract("1");
+            duplicate.key() = "2";
+            auto failed = cold.insert(std::move(duplicate));
+            test.check(!failed.inserted && !failed.node.empty());
+            test.equals(failed.position->second, 2);
+            test.equals(failed.node.mapped(), 1);
+            test.check(!cold.insert(UnorderedMap<std::string, int>::node_type()).inserted);
+        }),
+
+        make_test<PrettyTest>("merge", [](auto& test) {
+            using Map = UnorderedMap<int, int, std::hash<int>, std::equal_to<int>,
+                                     std::allocator<std::pair<const int, int>>, ModuloBucketPolicy, CountingStats>;
+            Map target;
+            Map source;
+            for (int i = 0; i < int(medium_size); ++i) {
+                target.emplace(2 * i, 0);
+                source.emplace(3 * i, 1);
+            }
+            const int* address = &source.at(3);
+            size_t rehashes = target.stats().rehashes;
+            target.merge(source);
+            test.check(target.stats().rehashes <= rehashes + 1);
+            test.equals(&target.at(3), address);
+            test.check(rng::all_of(source, [](const auto& item) { return item.first % 6 == 0; }));
+            test.equals(source.size(), size_t(std::distance(source.begin(), source.end())));
+            test.equals(target.size() + source.size(), 2 * medium_size);
+            test.check(rng::all_of(iota(0, 3 * int(medium_size)), [&](int key) {
+                bool in_target = key % 2 == 0 && key < 2 * int(medium_size);
+                return target.contains(key) == (in_target || key % 3 == 0) &&
+                       source.contains(key) == (in_target && key % 3 == 0);
+            }));
+            target.merge(Map(source));
+            target.merge(target);
+            test.equals(size_t(std::distance(target.begin(), target.end())), target.size());
+        }),
+
+        make_test<PrettyTest>("range construction and insert_range", [](auto& test) {
+            std::vector<std::pair<int, int>> pairs;
+            for (int i = 0; i < int(medium_size); ++i) {
+                pairs.emplace_back(i % int(small_size), i);
+            }
+            UnorderedMap<int, int> map(pairs.begin(), pairs.end());
+            test.equals(map.size(), small_size);
+            test.check(rng::all_of(iota(0, int(small_size)), [&](int key) { return map.at(key) == key; }));
+
+            map.insert_range(iota(0, int(medium_size)) | transform([](int i) { return std::pair(i, -i); }));
+            test.equals(map.size(), medium_size);
+            test.equals(map.at(0), 0);
+            test.equals(map.at(int(medium_size) - 1), 1 - int(medium_size));
+
+            UnorderedMap<int, int, std::hash<int>, std::equal_to<int>,
+                         std::allocator<std::pair<const int, int>>, ModuloBucketPolicy, CountingStats> counted;
+            counted.insert_range(pairs);
+            test.equals(counted.stats().rehashes, 1_sz);
+            test.equals(counted.size(), small_size);
+            test.check(counted.load_factor() <= counted.max_load_factor());
+
+            std::vector<std::pair<int, int>> copies(medium_size, std::pair(1, 1));
+            decltype(counted) single(copies.begin(), copies.end());
+            test.equals(single.size(), 1_sz);
+            test.equals(single.stats().allocations, 1_sz);
+            test.equals(single.stats().discarded_nodes, 0_sz);
+
+            UnorderedMap<int, int, ClusteringHash> clustered;
+            clustered.insert_range(iota(0, int(small_size)) | transform([](int i) { return std::pair(i % 8, i); }));
+            test.equals(clustered.size(), 8_sz);
+            test.check(rng::all_of(iota(0, 8), [&](int key) { return clustered.at(key) == key; }));
+            clustered.insert_range(pairs);
+            test.equals(clustered.size(), small_size);
+            test.equals(clustered.at(1), 1);
         })
     };
 }
@@ -301,12 +531,72 @@ TestGroup create_access_tests() {
             test.equals(storage[4], "");
         }),
 
+        make_test<PrettyTest>("[] constructs only on insert", [](auto& test){
+            static int constructed = 0;
+            struct Counted {
+                Counted() {
+                    ++constructed;
+                }
+                int value = 0;
+            };
+            UnorderedMap<int, Counted> map;
+            map[1].value = 1;
+            test.equals(constructed, 1);
+            test.equals(map[1].value, 1);
+            test.equals(constructed, 1);
+            UnorderedMap<int, std::vector<int>> vectors;
+            vectors[0].push_back(1);
+            vectors[0].push_back(2);
+            test.equals(vectors[0].size(), 2_sz);
+        }),
+
+        make_test<PrettyTest>("transparent lookup", [](auto& test){
+            UnorderedMap<std::string, int, StringHash, std::equal_to<>> map;
+            map.emplace("abc", 1);
+            map.emplace("def", 2);
+            std::string_view view = "abcdef";
+            test.equals(map.find(view.substr(0, 3))->second, 1);
+            test.equals(map.at(view.substr(3)), 2);
+            test.check(map.contains("abc"));
+            test.equals(map.count(view), 0_sz);
+            test.equals(map.erase(view.substr(3)), 1_sz);
+            test.check(!map.contains(std::string("def")));
+            const auto& const_map = map;
+            test.equals(const_map.at("abc"), 1);
+            test.check(const_map.find("xyz") == const_map.end());
+        }),
+
         make_test<PrettyTest>("find", [](auto& test){
             auto map = make_small_map<Trivial>();
             auto existing = map.find(1);
             test.equals(existing->second, 1_tr);
             auto non_existing = map.find(-1);
             test.equals(non_existing, map.end());
+        }),
+
+        make_test<PrettyTest>("batched lookup", [](auto& test){
+            UnorderedMap<int, int> map;
+            map.incremental_rehash(1);
+            for (int i = 0; i < int(medium_size); i += 2) {
+                map.emplace(i, i);
+            }
+            std::vector<int> keys(medium_size + 3);
+            std::iota(keys.begin(), keys.end(), -1);
+            std::vector<UnorderedMap<int, int>::iterator> found(keys.size());
+            std::unique_ptr<bool[]> flags(new bool[keys.size()]);
+            map.find_batch(keys, found);
+            map.contains_batch(keys, std::span(flags.get(), keys.size()));
+            for (size_t i = 0; i < keys.size(); ++i) {
+                test.check(found[i] == map.find(keys[i]));
+                test.equals(flags[i], map.contains(keys[i]));
+            }
+            const auto& const_map = map;
+            std::vector<UnorderedMap<int, int>::const_iterator> const_found(keys.size());
+            const_map.find_batch(keys, const_found);
+            test.check(rng::all_of(iota(size_t(0), keys.size()), [&](size_t i) {
+                return const_found[i] == const_map.find(keys[i]);
+            }));
+            test.check(std::ranges::count(std::span(flags.get(), keys.size()), true) == std::ptrdiff_t(map.size()));
         })
     };
 }
@@ -327,6 +617,629 @@ TestGroup create_misc_tests() {
                 test.check(map.load_factor() > 0.0f);
                 test.check(map.load_factor() <= new_load_factor);
             }
+        }),
+
+        make_test<PrettyTest>("bucket policies", [](auto& test) {
+            auto check_policy = [&]<typename Policy>(Policy) {
+                UnorderedMap<int, int, std::hash<int>, std::equal_to<int>,
+                             std::allocator<std::pair<const int, int>>, Policy> map;
+                for (int i = 0; i < int(medium_size); ++i) {
+                    map.emplace(i * 1024, i);
+                }
+                for (int i = 0; i < int(medium_size); i += 2) {
+                    map.erase(map.find(i * 1024));
+                }
+                test.equals(map.size(), medium_size / 2);
+                for (int i = 0; i < int(medium_size); ++i) {
+                    test.equals(map.find(i * 1024) == map.end(), i % 2 == 0);
+                }
+                test.check(map.load_factor() <= map.max_load_factor());
+            };
+            check_policy(ModuloBucketPolicy(1));
+            check_policy(PowerOfTwoBucketPolicy(1));
+            check_policy(FastRangeBucketPolicy(1));
+            check_policy(PrimeBucketPolicy(1));
+        }),
+
+        make_test<PrettyTest>("incremental rehash", [](auto& test) {
+            UnorderedMap<int, int> map;
+            map.incremental_rehash(1);
+            for (int i = 0; i < int(medium_size); ++i) {
+                map.emplace(i, i);
+                test.check(rng::all_of(iota(0, i + 1), [&](int key) { return map.at(key) == key; }));
+            }
+            for (int i = 0; i < int(medium_size); i += 2) {
+                test.equals(map.erase(i), 1_sz);
+            }
+            for (int i = int(medium_size); i < 2 * int(medium_size); ++i) {
+                map[i] = i;
+            }
+            test.equals(size_t(std::distance(map.begin(), map.end())), map.size());
+            test.check(rng::all_of(iota(0, 2 * int(medium_size)), [&](int key) {
+                return map.contains(key) == (key >= int(medium_size) || key % 2 == 1);
+            }));
+            test.check(map.load_factor() <= map.max_load_factor());
+
+            using Counted = UnorderedMap<int, int, std::hash<int>, std::equal_to<int>,
+                                         std::allocator<std::pair<const int, int>>, ModuloBucketPolicy, CountingStats>;
+            auto check_removal = [&test](auto remove) {
+                Counted counted;
+                counted.incremental_rehash(medium_size);
+                int inserted = 0;
+                while (counted.stats().rehashes < 2) {
+                    counted.emplace(inserted, inserted);
+                    ++inserted;
+                }
+                size_t moved = counted.stats().nodes_moved;
+                remove(counted, 0);
+                test.equals(counted.stats().nodes_moved, moved + size_t(inserted) - 1);
+                test.check(rng::all_of(iota(1, inserted), [&](int key) { return counted.at(key) == key; }));
+            };
+            check_removal([](Counted& counted, int key) { counted.erase(key); });
+            check_removal([](Counted& counted, int key) { counted.extract(key); });
+        }),
+
+        make_test<PrettyTest>("hash caching", [](auto& test) {
+            static_assert(!CacheHash<int, std::hash<int>>::value);
+            static_assert(CacheHash<int, IdentityHash>::value);
+            static_assert(CacheHash<std::string, std::hash<std::string>>::value);
+            UnorderedMap<int, int, IdentityHash, CountingEqual> cached;
+            UnorderedMap<int, int, std::hash<int>, CountingEqual> uncached;
+            cached.max_load_factor(float(medium_size));
+            uncached.max_load_factor(float(medium_size));
+            for (int i = 0; i < int(medium_size); ++i) {
+                cached.emplace(i, i);
+                uncached.emplace(i, i);
+            }
+            CountingEqual::calls = 0;
+            for (int i = -int(medium_size); i < int(medium_size); ++i) {
+                test.equals(cached.contains(i), i >= 0);
+            }
+            test.equals(CountingEqual::calls, medium_size);
+            CountingEqual::calls = 0;
+            for (int i = -int(medium_size); i < int(medium_size); ++i) {
+                test.equals(uncached.contains(i), i >= 0);
+            }
+            test.check(CountingEqual::calls > medium_size);
+            for (int i = 0; i < int(medium_size); i += 2) {
+                test.equals(uncached.erase(i), 1_sz);
+            }
+            uncached.rehash(medium_size);
+            test.check(rng::all_of(iota(0, int(medium_size)), [&](int key) {
+                return uncached.contains(key) == (key % 2 == 1);
+            }));
+        }),
+
+        make_test<PrettyTest>("stats policy", [](auto& test) {
+            UnorderedMap<int, int, std::hash<int>, std::equal_to<int>,
+                         std::allocator<std::pair<const int, int>>, ModuloBucketPolicy, CountingStats> map;
+            for (int i = 0; i < int(small_size); ++i) {
+                map.emplace(i, i);
+            }
+            map.emplace(std::piecewise_construct, std::forward_as_tuple(0), std::forward_as_tuple(1));
+            test.check(!map.contains(-1));
+            MapStats stats = map.stats();
+            test.equals(stats.allocations, small_size + 1);
+            test.equals(stats.discarded_nodes, 1_sz);
+            test.check(stats.rehashes > 0);
+            test.check(stats.nodes_moved >= small_size / 2);
+            test.check(stats.lookups >= small_size + 2);
+            test.check(stats.max_probes >= 1);
+            test.check(stats.max_chain_length >= 1);
+            test.check(stats.average_chain_length >= 1.0);
+
+            std::vector<std::thread> readers;
+            const auto& shared = map;
+            for (size_t t = 0; t < 4; ++t) {
+                readers.emplace_back([&] {
+                    for (int i = 0; i < int(medium_size); ++i) {
+                        [[maybe_unused]] auto found = shared.find(i % int(small_size));
+                    }
+                });
+            }
+            rng::for_each(readers, &std::thread::join);
+            test.equals(map.stats().lookups, stats.lookups + 4 * medium_size);
+
+            decltype(map) other;
+            other.swap(map);
+            test.equals(other.stats().lookups, stats.lookups + 4 * medium_size);
+            test.equals(map.stats().lookups, 0_sz);
+            map = std::move(other);
+            test.equals(map.stats().allocations, small_size + 1);
+        }),
+
+        make_test<PrettyTest>("bucket diagnostics", [](auto& test) {
+            UnorderedMap<int, int> map;
+            UnorderedMap<int, int, ClusteringHash> clustered;
+            for (int i = 0; i < int(medium_size); ++i) {
+                map.emplace(i * 7919, i);
+                clustered.emplace(i, i);
+            }
+            size_t total = 0;
+            for (size_t n = 0; n < map.bucket_count(); ++n) {
+                total += map.bucket_size(n);
+            }
+            test.equals(total, map.size());
+            test.check(map.bucket(7919) < map.bucket_count());
+            test.check(map.bucket_size(map.bucket(7919)) >= 1);
+
+            BucketDiagnostics full = map.diagnostics();
+            test.equals(full.buckets_examined, map.bucket_count());
+            test.equals(std::accumulate(full.chain_length_histogram.begin(), full.chain_length_histogram.end(), 0_sz),
+                        map.bucket_count());
+            test.check(full.empty_fraction >= 0 && full.empty_fraction <= 1);
+            test.check(clustered.diagnostics().chi_squared > 10 * full.chi_squared);
+            test.equals(map.diagnostics(small_size).buckets_examined, small_size);
+
+            UnorderedMap<int, int> incremental;
+            incremental.incremental_rehash(1);
+            for (int i = 0; i < int(medium_size * small_size); ++i) {
+                incremental.emplace(i, i);
+            }
+            total = 0;
+            for (size_t n = 0; n < incremental.bucket_count(); ++n) {
+                total += incremental.bucket_size(n);
+            }
+            test.equals(total, incremental.size());
+            test.check(rng::all_of(iota(0, int(medium_size * small_size)), [&](int key) {
+                return incremental.bucket_size(incremental.bucket(key)) >= 1;
+            }));
+            std::vector<size_t> histogram = incremental.diagnostics().chain_length_histogram;
+            test.equals(std::accumulate(histogram.begin(), histogram.end(), 0_sz), incremental.bucket_count());
+            test.equals(std::inner_product(histogram.begin(), histogram.end(), iota(0_sz).begin(), 0_sz),
+                        incremental.size());
+
+            UnorderedMap<int, int> moved_to = std::move(map);
+            BucketDiagnostics empty = map.diagnostics();
+            test.equals(empty.buckets_examined, 0_sz);
+            test.check(empty.chain_length_histogram.empty());
+            test.equals(moved_to.diagnostics().buckets_examined, moved_to.bucket_count());
+        }),
+
+        make_test<PrettyTest>("pool allocator", [](auto& test) {
+            using Alloc = PoolAllocator<std::pair<const int, std::string>>;
+            using Map = UnorderedMap<int, std::string, std::hash<int>, std::equal_to<int>, Alloc>;
+            Map map;
+            for (int i = 0; i < int(medium_size); ++i) {
+                map.emplace(i, std::to_string(i));
+            }
+            for (int i = 0; i < int(medium_size); i += 2) {
+                map.erase(map.find(i));
+            }
+            for (int i = 0; i < int(medium_size); i += 2) {
+                map.emplace(i, std::to_string(-i));
+            }
+            Map another;
+            another.emplace(-1, "-1");
+            map.swap(another);
+            test.equals(map.size(), 1_sz);
+            test.equals(another.size(), medium_size);
+            test.equals(another.at(4), "-4");
+            test.equals(another.at(5), "5");
+
+            UnorderedMap<int, int, std::hash<int>, std::equal_to<int>, PoolAllocator<std::pair<const int, int>>> trivial;
+            for (int i = 0; i < int(medium_size); ++i) {
+                trivial.emplace(i, i);
+            }
+            test.equals(trivial.at(7), 7);
+
+            Map source;
+            source.emplace(-1, "minus one");
+            for (int i = 0; i < int(small_size); ++i) {
+                source.emplace(i, std::to_string(i));
+            }
+            map.merge(source);
+            test.equals(map.size(), small_size + 1);
+            test.equals(source.size(), 1_sz);
+            test.equals(map.at(int(small_size) - 1), std::to_string(small_size - 1));
+            auto duplicate = map.insert(source.extract(-1));
+            test.check(!duplicate.inserted && duplicate.node.mapped() == "minus one");
+            auto moved = map.insert(another.extract(int(medium_size) - 1));
+            test.check(moved.inserted && moved.position->second == std::to_string(medium_size - 1));
+            map.merge(another);
+            test.equals(map.size(), medium_size + 1);
+            test.equals(another.size(), small_size);
+            test.equals(map.at(4), "4");
+            test.equals(map.at(int(small_size) + 1), std::to_string(-int(small_size) - 1));
+        }),
+
+        make_test<PrettyTest>("shrinking", [](auto& test) {
+            using Alloc = PoolAllocator<std::pair<const int, int>, small_size>;
+            UnorderedMap<int, int, std::hash<int>, std::equal_to<int>, Alloc> map;
+            for (int i = 0; i < int(medium_size * medium_size); ++i) {
+                map.emplace(i, i);
+            }
+            size_t peak_buckets = map.bucket_count();
+            for (int i = 0; i < int(medium_size * medium_size); ++i) {
+                if (i % 10 != 0) {
+                    map.erase(i);
+                }
+            }
+            test.equals(map.bucket_count(), peak_buckets);
+            map.shrink_to_fit();
+            test.check(map.bucket_count() * 5 < peak_buckets);
+            test.check(map.load_factor() <= map.max_load_factor());
+            test.check(rng::all_of(iota(0, int(medium_size * medium_size)), [&](int key) {
+                return map.contains(key) == (key % 10 == 0);
+            }));
+
+            UnorderedMap<int, int> automatic;
+            automatic.min_load_factor(0.1F);
+            test.equals(automatic.min_load_factor(), 0.1F);
+            for (int i = 0; i < int(medium_size * medium_size); ++i) {
+                automatic.emplace(i, i);
+            }
+            peak_buckets = automatic.bucket_count();
+            for (int i = 0; i < int(medium_size * medium_size); ++i) {
+                if (i % 20 != 0) {
+                    automatic.erase(i);
+                }
+            }
+            automatic.emplace(-1, -1);
+            test.check(automatic.bucket_count() * 5 < peak_buckets);
+            test.check(automatic.load_factor() >= automatic.max_load_factor() / 4);
+            test.equals(automatic.size(), medium_size * medium_size / 20 + 1);
+            test.equals(automatic.at(20), 20);
+
+            UnorderedMap<int, int> incremental;
+            incremental.min_load_factor(0.1F);
+            incremental.incremental_rehash(1);
+            for (int i = 0; i < int(medium_size * medium_size); ++i) {
+                incremental.emplace(i, i);
+            }
+            peak_buckets = incremental.bucket_count();
+            for (int i = 0; i < int(medium_size * medium_size); ++i) {
+                if (i % 20 != 0) {
+                    incremental.erase(i);
+                }
+            }
+            incremental.emplace(-1, -1);
+            test.check(incremental.bucket_count() * 5 < peak_buckets);
+            test.check(rng::all_of(iota(0, int(medium_size * medium_size)), [&](int key) {
+                return incremental.contains(key) == (key % 20 == 0);
+            }));
+            for (int i = 0; i < int(medium_size * medium_size); ++i) {
+                incremental.emplace(i, i);
+            }
+            test.equals(incremental.size(), medium_size * medium_size + 1);
+            test.equals(incremental.at(medium_size), int(medium_size));
+
+            UnorderedMap<int, int> floored;
+            floored.min_load_factor(0.2F);
+            floored.reserve(medium_size * medium_size);
+            peak_buckets = floored.bucket_count();
+            floored.emplace(1, 1);
+            test.equals(floored.bucket_count(), peak_buckets);
+            floored.shrink_to_fit();
+            test.check(floored.bucket_count() < small_size);
+            floored.emplace(2, 2);
+            test.check(floored.bucket_count() < small_size);
+
+            detail::FixedPool pool(sizeof(void*), alignof(void*), small_size);
+            std::vector<void*> blocks(medium_size);
+            rng::generate(blocks, [&] { return pool.allocate(); });
+            size_t reserved = pool.reserved_bytes();
+            for (size_t i = 1; i < blocks.size(); ++i) {
+                pool.deallocate(blocks[i]);
+            }
+            test.check(pool.trim() > 0);
+            test.check(pool.reserved_bytes() < reserved && pool.reserved_bytes() > 0);
+            test.check(pool.allocate() != blocks[0]);
+            pool.deallocate(blocks[0]);
+        })
+    };
+}
+
+//NOLINTNEXTLINE
+TestGroup create_flat_map_tests() {
+    return { "flat map",
+        make_test<PrettyTest>("emplace and find", [](auto& test){
+            FlatUnorderedMap<int, NonTrivial> map;
+            for (int i = 0; i < int(medium_size); ++i) {
+                auto [place, did_insert] = map.emplace(i, NonTrivial{i});
+                test.check(did_insert);
+                test.equals(place->second, NonTrivial{i});
+            }
+            auto [old_place, reinsert] = map.emplace(1, 3_ntr);
+            test.check(!reinsert);
+            test.equals(old_place->second, 1_ntr);
+            test.equals(map.size(), medium_size);
+            test.equals(map.find(-1), map.end());
+            test.equals(size_t(std::distance(map.begin(), map.end())), medium_size);
+            test.check(map.load_factor() <= map.max_load_factor());
+        }),
+
+        make_test<PrettyTest>("erase and reinsert", [](auto& test){
+            FlatUnorderedMap<std::string, int> map;
+            for (int i = 0; i < int(medium_size); ++i) {
+                map[std::to_string(i)] = i;
+            }
+            for (int i = 0; i < int(medium_size); i += 2) {
+                map.erase(map.find(std::to_string(i)));
+            }
+            test.equals(map.size(), medium_size / 2);
+            for (int i = 0; i < int(medium_size); ++i) {
+                test.equals(map.find(std::to_string(i)) == map.end(), i % 2 == 0);
+            }
+            for (int i = 0; i < int(medium_size); i += 2) {
+                test.check(map.emplace(std::to_string(i), -i).second);
+            }
+            test.equals(map.size(), medium_size);
+            test.equals(map.at("4"), -4);
+            test.equals(map.at("5"), 5);
+        }),
+
+        make_test<PrettyTest>("copy and move", [](auto& test){
+            FlatUnorderedMap<int, std::string> map;
+            for (int i = 0; i < int(small_size); ++i) {
+                map.emplace(i, std::to_string(i));
+            }
+            auto copy = map;
+            test.check(copy == map);
+            auto move_copy = std::move(map);
+            test.check(copy == move_copy);
+            test.equals(map.size(), 0_sz);
+            map = copy;
+            test.equals(map.at(3), "3");
+        }),
+
+        make_test<PrettyTest>("colliding fingerprints", [](auto& test){
+            // keys sharing a fingerprint whose probes start two slots before the end of a
+            // 31-slot table, so they fill more than one group and wrap through the cloned control bytes
+            constexpr size_t capacity = 31;
+            constexpr size_t fingerprint_bits = 7;
+            constexpr size_t fingerprint_mask = (size_t{1} << fingerprint_bits) - 1;
+            constexpr size_t count = 20;
+            std::vector<int> keys;
+            std::optional<size_t> fingerprint;
+            for (int key = 0; keys.size() <= count; ++key) {
+                size_t hash = detail::hash_mix(size_t(key));
+                if (((hash >> fingerprint_bits) & capacity) == capacity - 2 &&
+                    fingerprint.value_or(hash & fingerprint_mask) == (hash & fingerprint_mask)) {
+                    fingerprint = hash & fingerprint_mask;
+                    keys.push_back(key);
+                }
+            }
+            int missing = keys.back();
+            keys.pop_back();
+
+            FlatUnorderedMap<int, int, IdentityHash> map;
+            map.rehash(capacity);
+            for (int key : keys) {
+                test.check(map.emplace(key, -key).second);
+            }
+            test.equals(map.size(), count);
+            test.check(rng::all_of(keys, [&](int key) { return map.at(key) == -key; }));
+            test.equals(map.find(missing), map.end());
+            test.equals(size_t(std::distance(map.begin(), map.end())), count);
+
+            for (size_t i = 0; i < count; i += 2) {
+                map.erase(map.find(keys[i]));
+            }
+            for (size_t i = 0; i < count; ++i) {
+                test.equals(map.find(keys[i]) == map.end(), i % 2 == 0);
+            }
+            test.check(map.emplace(missing, 0).second);
+            test.check(map.emplace(keys[0], 0).second);
+            test.equals(map.size(), count / 2 + 2);
+            test.equals(map.at(keys[1]), -keys[1]);
+        }),
+
+        make_test<PrettyTest>("failures and load factor", [](auto& test){
+            FlatUnorderedMap<int, FragileCopy> map;
+            int inserted = 0;
+            for (; map.load_factor() < map.max_load_factor() - 0.1F || map.size() < small_size; ++inserted) {
+                map.emplace(inserted, inserted);
+            }
+            FragileCopy existing(-1);
+            FragileCopy::fail = true;
+            test.check(!map.emplace(0, existing).second);
+            try {
+                for (int i = inserted; i < 2 * inserted; ++i) {
+                    map.emplace(i, i);
+                }
+                test.fail();
+            } catch (const std::runtime_error&) {}
+            FragileCopy::fail = false;
+            test.check(map.size() >= size_t(inserted));
+            test.check(rng::all_of(iota(0, int(map.size())), [&](int key) { return map.at(key).data == key; }));
+
+            FlatUnorderedMap<int, int> resized;
+            for (int i = 0; i < int(medium_size); ++i) {
+                resized.emplace(i, i);
+            }
+            const int* address = &resized.at(0);
+            resized.max_load_factor(0.95F);
+            test.equals(&resized.at(0), address);
+            resized.max_load_factor(0.1F);
+            test.check(resized.load_factor() <= 0.1F);
+            test.check(rng::all_of(iota(0, int(medium_size)), [&](int key) { return resized.at(key) == key; }));
+        })
+    };
+}
+
+//NOLINTNEXTLINE
+TestGroup create_concurrent_tests() {
+    return { "concurrent",
+        make_test<PrettyTest>("sharded map", [](auto& test){
+            ShardedUnorderedMap<int, int> map(8);
+            const int threads = 4;
+            const int per_thread = 1000;
+            std::vector<std::thread> workers;
+            for (int t = 0; t < threads; ++t) {
+                workers.emplace_back([&map, t] {
+                    for (int i = t * per_thread; i < (t + 1) * per_thread; ++i) {
+                        map.emplace(i, i);
+                        map.visit(i, [](auto& item) { item.second *= 2; });
+                        map.contains(i / 2);
+                    }
+                    for (int i = t * per_thread; i < (t + 1) * per_thread; i += 2) {
+                        map.erase(i);
+                    }
+                });
+            }
+            for (auto& worker : workers) {
+                worker.join();
+            }
+            test.equals(map.size(), size_t(threads * per_thread / 2));
+            test.equals(map.find(1), std::optional<int>(2));
+            test.equals(map.find(2), std::optional<int>());
+            test.check(!map.emplace(1, 0));
+            test.check(!map.insert_or_assign(1, 5));
+            test.equals(map.find(1), std::optional<int>(5));
+            long long sum = 0;
+            map.visit_all([&sum](const auto& item) { sum += item.first; });
+            test.equals(sum, 1LL * threads * per_thread * threads * per_thread / 4);
+        }),
+        make_test<PrettyTest>("parallel build", [](auto& test){
+            const int count = 10000;
+            std::vector<std::pair<int, std::string>> pairs;
+            for (int i = 0; i < count; ++i) {
+                pairs.emplace_back(i % (count / 3), std::to_string(i));
+            }
+            UnorderedMap<int, std::string> serial(pairs.begin(), pairs.end());
+            auto parallel = UnorderedMap<int, std::string>::build_parallel(pairs, 4);
+            test.equals(parallel.size(), serial.size());
+            test.equals(size_t(std::distance(parallel.begin(), parallel.end())), parallel.size());
+            test.check(rng::all_of(serial, [&](const auto& item) { return parallel.at(item.first) == item.second; }));
+            test.check(parallel.load_factor() <= parallel.max_load_factor());
+            parallel.emplace(count, "new");
+            parallel.erase(0);
+            test.equals(parallel.size(), serial.size());
+
+            using PoolMap = UnorderedMap<int, std::string, std::hash<int>, std::equal_to<int>,
+                                         PoolAllocator<std::pair<const int, std::string>>>;
+            auto pooled = PoolMap::build_parallel(pairs, 3);
+            test.equals(pooled.size(), serial.size());
+            test.equals(pooled.at(1), "1");
+        }),
+
+        make_test<PrettyTest>("parallel rehash", [](auto& test){
+            const int count = 10000;
+            UnorderedMap<int, int> map;
+            UnorderedMap<int, int> twin;
+            map.incremental_rehash(1);
+            for (int i = 0; i < count; ++i) {
+                map.emplace(i, -i);
+                twin.emplace(i, -i);
+            }
+            map.rehash(4 * size_t(count), 4);
+            twin.rehash(4 * size_t(count), 4);
+            test.check(map.bucket_count() >= 4 * size_t(count));
+            test.equals(size_t(std::distance(map.begin(), map.end())), map.size());
+            test.check(rng::all_of(iota(0, count), [&](int key) { return map.at(key) == -key; }));
+            test.check(rng::equal(map, twin));
+            for (int i = 0; i < count; i += 2) {
+                map.erase(i);
+            }
+            map.rehash(0, 3);
+            test.equals(map.size(), size_t(count / 2));
+            test.check(rng::all_of(iota(0, count), [&](int key) { return map.contains(key) == (key % 2 == 1); }));
+        }),
+
+        make_test<PrettyTest>("parallel for_each", [](auto& test){
+            const int count = 10000;
+            UnorderedMap<int, int> map;
+            map.incremental_rehash(1);
+            for (int i = 0; i < count; ++i) {
+                map.emplace(i, i);
+            }
+            std::atomic<long long> sum = 0;
+            map.parallel_for_each([&sum](auto& item) {
+                item.second *= 2;
+                sum += item.first;
+            }, 4);
+            test.equals(sum.load(), 1LL * count * (count - 1) / 2);
+            test.check(rng::all_of(iota(0, count), [&](int key) { return map.at(key) == 2 * key; }));
+            const auto& const_map = map;
+            std::atomic<size_t> visited = 0;
+            const_map.parallel_for_each([&visited](const auto&) { ++visited; }, 3);
+            test.equals(visited.load(), map.size());
+        }),
+
+        make_test<PrettyTest>("read-mostly map", [](auto& test){
+            ReadMostlyUnorderedMap<int, std::string> map;
+            const int keys = 2000;
+            const int readers = 3;
+            std::atomic<bool> done = false;
+            std::atomic<bool> consistent = true;
+            std::vector<std::thread> workers;
+            for (int t = 0; t < readers; ++t) {
+                workers.emplace_back([&] {
+                    while (!done.load()) {
+                        for (int i = 0; i < keys; ++i) {
+                            auto value = map.find(i);
+                            if (value && *value != std::to_string(i) && *value != std::to_string(-i)) {
+                                consistent = false;
+                            }
+                        }
+                    }
+                });
+            }
+            for (int i = 0; i < keys; ++i) {
+                map.emplace(i, std::to_string(i));
+            }
+            for (int i = 0; i < keys; i += 2) {
+                map.insert_or_assign(i, std::to_string(-i));
+                map.erase(i + 1);
+            }
+            done = true;
+            for (auto& worker : workers) {
+                worker.join();
+            }
+            test.check(consistent.load());
+            test.equals(map.size(), size_t(keys / 2));
+            test.equals(map.find(4), std::optional<std::string>("-4"));
+            test.check(!map.contains(5));
+            test.check(!map.emplace(4, "4"));
+        }),
+
+        make_test<PrettyTest>("read-mostly map failures", [](auto& test){
+            ReadMostlyUnorderedMap<int, FragileCopy> fragile;
+            FragileCopy::fail = true;
+            for (int i = 0; i < int(small_size); ++i) {
+                fragile.emplace(i, i);
+            }
+            test.equals(fragile.size(), small_size);
+            FragileCopy replacement(-1);
+            try {
+                fragile.insert_or_assign(0, replacement);
+                test.fail();
+            } catch (const std::runtime_error&) {}
+            FragileCopy::fail = false;
+            test.equals(fragile.find(0)->data, 0);
+            test.check(fragile.insert_or_assign(int(small_size), replacement));
+            test.equals(fragile.size(), small_size + 1);
+
+            ReadMostlyUnorderedMap<int, std::unique_ptr<int>> owners;
+            for (int i = 0; i < int(medium_size); ++i) {
+                owners.emplace(i, std::make_unique<int>(i));
+            }
+            owners.erase(0);
+            bool owned = false;
+            test.check(owners.visit(int(medium_size) - 1, [&owned](const auto& item) {
+                owned = *item.second == int(medium_size) - 1;
+            }));
+            test.check(owned);
+            test.check(!owners.contains(0));
+
+            ReadMostlyUnorderedMap<int, int> map;
+            map.emplace(1, 1);
+            const size_t threads = detail::ThreadSlots::max_threads + small_size;
+            std::latch all_read(static_cast<std::ptrdiff_t>(threads));
+            std::atomic<size_t> found = 0;
+            std::vector<std::thread> workers;
+            for (size_t t = 0; t < threads; ++t) {
+                workers.emplace_back([&] {
+                    found += map.find(1) == std::optional<int>(1) ? 1 : 0;
+                    all_read.arrive_and_wait();
+                    found += map.contains(1) && !map.contains(2) ? 1 : 0;
+                });
+            }
+            for (auto& worker : workers) {
+                worker.join();
+            }
+            test.equals(found.load(), 2 * threads);
         })
     };
 }
@@ -338,6 +1251,8 @@ int main() {
     groups.push_back(create_modification_tests());
     groups.push_back(create_access_tests());
     groups.push_back(create_misc_tests());
+    groups.push_back(create_flat_map_tests());
+    groups.push_back(create_concurrent_tests());
 
     bool res = true;
     for (auto& group : groups) {
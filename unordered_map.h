@@ -1,30 +1,640 @@
 #include <iostream>
 #include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <span>
 #include <iterator>
+#include <limits>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <concepts>
+#include <cstddef>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <functional>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#if (defined(__SSE2__) || defined(_M_X64)) && !defined(UNORDERED_MAP_DISABLE_SIMD)
+#include <emmintrin.h>
+#define UNORDERED_MAP_USE_SSE2
+#endif
+
+#ifdef UNORDERED_MAP_ENABLE_EXECUTION
+#include <execution>
+#endif
+
+namespace detail {
+
+inline size_t hash_mix(size_t hash) {
+    constexpr size_t shift = 33;
+    constexpr size_t first_multiplier = 0xff51afd7ed558ccd;
+    constexpr size_t second_multiplier = 0xc4ceb9fe1a85ec53;
+    hash ^= hash >> shift;
+    hash *= first_multiplier;
+    hash ^= hash >> shift;
+    hash *= second_multiplier;
+    hash ^= hash >> shift;
+    return hash;
+}
+
+inline size_t mul_high(size_t lhs, size_t rhs) {
+    constexpr size_t word_bits = sizeof(size_t) * CHAR_BIT;
+#ifdef __SIZEOF_INT128__
+    __extension__ typedef unsigned __int128 uint128;
+    return static_cast<size_t>((static_cast<uint128>(lhs) * rhs) >> word_bits);
+#else
+    constexpr size_t half_bits = word_bits / 2;
+    constexpr size_t half_mask = (size_t{1} << half_bits) - 1;
+    size_t lhs_low = lhs & half_mask;
+    size_t lhs_high = lhs >> half_bits;
+    size_t rhs_low = rhs & half_mask;
+    size_t rhs_high = rhs >> half_bits;
+    size_t cross = (lhs_low * rhs_low >> half_bits) + (lhs_high * rhs_low & half_mask) + lhs_low * rhs_high;
+    return lhs_high * rhs_high + (lhs_high * rhs_low >> half_bits) + (cross >> half_bits);
+#endif
+}
+
+constexpr std::array<size_t, 64> prime_bucket_counts = {
+    1, 3, 5, 11, 17, 37, 67, 131, 257, 521, 1031, 2053, 4099, 8209, 16411, 32771, 65537, 131101, 262147,
+    524309, 1048583, 2097169, 4194319, 8388617, 16777259, 33554467, 67108879, 134217757, 268435459,
+    536870923, 1073741827, 2147483659, 4294967311, 8589934609, 17179869209, 34359738421, 68719476767,
+    137438953481, 274877906951, 549755813911, 1099511627791, 2199023255579, 4398046511119, 8796093022237,
+    17592186044423, 35184372088891, 70368744177679, 140737488355333, 281474976710677, 562949953421381,
+    1125899906842679, 2251799813685269, 4503599627370517, 9007199254740997, 18014398509482143,
+    36028797018963971, 72057594037928017, 144115188075855881, 288230376151711813, 576460752303423619,
+    1152921504606847009, 2305843009213693967, 4611686018427388039, 9223372036854775837u
+};
+
+template <size_t Index>
+size_t prime_mod(size_t hash) {
+    constexpr size_t divisor = prime_bucket_counts[Index];
+    return hash % divisor;
+}
+
+template <size_t... Indices>
+constexpr auto make_prime_mods(std::index_sequence<Indices...>) {
+    return std::array<size_t (*)(size_t), sizeof...(Indices)>{&prime_mod<Indices>...};
+}
+
+constexpr auto prime_mods = make_prime_mods(std::make_index_sequence<prime_bucket_counts.size()>());
+
+template <typename Arg, typename Key>
+concept PairWithKey = requires {
+    typename std::remove_cvref_t<Arg>::first_type;
+    typename std::remove_cvref_t<Arg>::second_type;
+} && std::same_as<std::remove_cv_t<typename std::remove_cvref_t<Arg>::first_type>, Key>;
+
+template <typename Hash, typename KeyEqual>
+concept TransparentLookup = requires {
+    typename Hash::is_transparent;
+    typename KeyEqual::is_transparent;
+};
+
+template <typename F>
+void parallel_run(size_t num_threads, F&& func) {
+    std::vector<std::exception_ptr> errors(num_threads);
+    auto guarded = [&func, &errors](size_t index) {
+        try {
+            func(index);
+        } catch (...) {
+            errors[index] = std::current_exception();
+        }
+    };
+    std::vector<std::thread> workers;
+    workers.reserve(num_threads);
+    size_t started = 1;
+    for (; started < num_threads; ++started) {
+        try {
+            workers.emplace_back(guarded, started);
+        } catch (const std::system_error&) {
+            break;
+        }
+    }
+    for (size_t index = started; index < num_threads; ++index) {
+        guarded(index);
+    }
+    guarded(0);
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    for (auto& error : errors) {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+}
+
+inline size_t chunk_begin(size_t count, size_t chunks, size_t index) {
+    return count / chunks * index + count % chunks * index / chunks;
+}
+
+inline void prefetch(const void* address) {
+#if defined(__GNUC__) || defined(__clang__)
+    __builtin_prefetch(address);
+#else
+    static_cast<void>(address);
+#endif
+}
+
+}  // namespace detail
+
+class ModuloBucketPolicy {
+public:
+    explicit ModuloBucketPolicy(size_t count) : count(std::max<size_t>(count, 1)) {}
+
+    size_t bucket_count() const {
+        return count;
+    }
+
+    size_t index(size_t hash) const {
+        return hash % count;
+    }
+
+private:
+    size_t count;
+};
+
+class PowerOfTwoBucketPolicy {
+public:
+    explicit PowerOfTwoBucketPolicy(size_t count) : mask(std::bit_ceil(std::max<size_t>(count, 1)) - 1) {}
+
+    size_t bucket_count() const {
+        return mask + 1;
+    }
+
+    size_t index(size_t hash) const {
+        return detail::hash_mix(hash) & mask;
+    }
+
+private:
+    size_t mask;
+};
+
+class FastRangeBucketPolicy {
+public:
+    explicit FastRangeBucketPolicy(size_t count) : count(std::max<size_t>(count, 1)) {}
+
+    size_t bucket_count() const {
+        return count;
+    }
+
+    size_t index(size_t hash) const {
+        constexpr size_t golden_ratio = 0x9e3779b97f4a7c15;
+        return detail::mul_high(hash * golden_ratio, count);
+    }
+
+private:
+    size_t count;
+};
+
+class PrimeBucketPolicy {
+public:
+    explicit PrimeBucketPolicy(size_t count) {
+        auto it = std::lower_bound(detail::prime_bucket_counts.begin(), detail::prime_bucket_counts.end(), count);
+        if (it == detail::prime_bucket_counts.end()) {
+            throw std::length_error("Bucket count is too large");
+        }
+        prime_index = static_cast<size_t>(it - detail::prime_bucket_counts.begin());
+    }
+
+    size_t bucket_count() const {
+        return detail::prime_bucket_counts[prime_index];
+    }
+
+    size_t index(size_t hash) const {
+        return detail::prime_mods[prime_index](hash);
+    }
+
+private:
+    size_t prime_index = 0;
+};
+
+namespace detail {
+
+class FixedPool {
+public:
+    FixedPool(size_t block_size, size_t alignment, size_t max_blocks_per_chunk) :
+            block_size(block_size),
+            alignment(alignment),
+            max_blocks_per_chunk(max_blocks_per_chunk) {}
+
+    FixedPool(const FixedPool&) = delete;
+    FixedPool& operator=(const FixedPool&) = delete;
+
+    bool fits(size_t size, size_t align) const {
+        return block_size == size && alignment == align;
+    }
+
+    void* allocate() {
+        ++live;
+        if (free_list) {
+            FreeBlock* block = free_list;
+            free_list = block->next;
+            return block;
+        }
+        if (cursor == chunk_end) {
+            try {
+                add_chunk();
+            } catch (...) {
+                --live;
+                throw;
+            }
+        }
+        void* block = cursor;
+        cursor += block_size;
+        return block;
+    }
+
+    void deallocate(void* ptr) {
+        --live;
+        free_list = ::new (ptr) FreeBlock{free_list};
+    }
+
+    size_t live_blocks() const {
+        return live;
+    }
+
+    void release() {
+        for (auto& [chunk, bytes] : chunks) {
+            ::operator delete(chunk, bytes, std::align_val_t(alignment));
+        }
+        chunks.clear();
+        free_list = nullptr;
+        cursor = nullptr;
+        chunk_end = nullptr;
+        next_blocks_per_chunk = min_blocks_per_chunk;
+        live = 0;
+    }
+
+    // frees the chunks none of whose blocks are in use and returns the number of bytes given back
+    size_t trim() {
+        if (live == 0) {
+            size_t bytes = reserved_bytes();
+            release();
+            return bytes;
+        }
+        std::sort(chunks.begin(), chunks.end(), [](const auto& lhs, const auto& rhs) {
+            return std::less<const std::byte*>()(lhs.first, rhs.first);
+        });
+        std::vector<size_t> free_blocks(chunks.size());
+        for (FreeBlock* block = free_list; block; block = block->next) {
+            ++free_blocks[chunk_of(block)];
+        }
+        std::vector<bool> released(chunks.size());
+        size_t bytes = 0;
+        for (size_t i = 0; i < chunks.size(); ++i) {
+            released[i] = free_blocks[i] == issued_blocks(chunks[i]);
+            bytes += released[i] ? chunks[i].second : 0;
+        }
+        FreeBlock** link = &free_list;
+        while (*link) {
+            if (released[chunk_of(*link)]) {
+                *link = (*link)->next;
+            } else {
+                link = &(*link)->next;
+            }
+        }
+        size_t kept = 0;
+        for (size_t i = 0; i < chunks.size(); ++i) {
+            if (!released[i]) {
+                chunks[kept++] = chunks[i];
+            } else {
+                if (chunks[i].first + chunks[i].second == chunk_end) {
+                    cursor = nullptr;
+                    chunk_end = nullptr;
+                }
+                ::operator delete(chunks[i].first, chunks[i].second, std::align_val_t(alignment));
+            }
+        }
+        chunks.resize(kept);
+        return bytes;
+    }
+
+    size_t reserved_bytes() const {
+        size_t bytes = 0;
+        for (const auto& chunk : chunks) {
+            bytes += chunk.second;
+        }
+        return bytes;
+    }
+
+    ~FixedPool() {
+        release();
+    }
+
+private:
+    struct FreeBlock {
+        FreeBlock* next;
+    };
+
+    static constexpr size_t min_blocks_per_chunk = 16;
+
+    size_t chunk_of(const void* block) const {
+        auto address = static_cast<const std::byte*>(block);
+        auto before = [](const std::byte* value, const auto& chunk) {
+            return std::less<const std::byte*>()(value, chunk.first);
+        };
+        auto it = std::upper_bound(chunks.begin(), chunks.end(), address, before);
+        return static_cast<size_t>(it - chunks.begin()) - 1;
+    }
+
+    size_t issued_blocks(const std::pair<std::byte*, size_t>& chunk) const {
+        if (chunk.first + chunk.second == chunk_end) {
+            return static_cast<size_t>(cursor - chunk.first) / block_size;
+        }
+        return chunk.second / block_size;
+    }
+
+    void add_chunk() {
+        size_t bytes = next_blocks_per_chunk * block_size;
+        chunks.reserve(chunks.size() + 1);
+        auto* chunk = static_cast<std::byte*>(::operator new(bytes, std::align_val_t(alignment)));
+        chunks.emplace_back(chunk, bytes);
+        cursor = chunk;
+        chunk_end = chunk + bytes;
+        next_blocks_per_chunk = std::min(2 * next_blocks_per_chunk, max_blocks_per_chunk);
+    }
+
+    size_t block_size;
+    size_t alignment;
+    size_t max_blocks_per_chunk;
+    size_t next_blocks_per_chunk = min_blocks_per_chunk;
+    size_t live = 0;
+
+    FreeBlock* free_list = nullptr;
+    std::byte* cursor = nullptr;
+    std::byte* chunk_end = nullptr;
+    std::vector<std::pair<std::byte*, size_t>> chunks;
+};
+
+class PoolArena {
+public:
+    FixedPool* pool_for(size_t size, size_t align, size_t max_blocks_per_chunk) {
+        align = std::max(align, alignof(void*));
+        size = (std::max(size, sizeof(void*)) + align - 1) / align * align;
+        for (auto& pool : pools) {
+            if (pool->fits(size, align)) {
+                return pool.get();
+            }
+        }
+        pools.push_back(std::make_unique<FixedPool>(size, align, max_blocks_per_chunk));
+        return pools.back().get();
+    }
+
+private:
+    std::vector<std::unique_ptr<FixedPool>> pools;
+};
+
+}  // namespace detail
+
+template <typename T, size_t MaxBlocksPerChunk = 4096>
+class PoolAllocator {
+public:
+    using value_type = T;
+    using propagate_on_container_copy_assignment = std::false_type;
+    using propagate_on_container_move_assignment = std::true_type;
+    using propagate_on_container_swap = std::true_type;
+
+    template <typename U>
+    struct rebind {
+        using other = PoolAllocator<U, MaxBlocksPerChunk>;
+    };
+
+    PoolAllocator() : PoolAllocator(std::make_shared<detail::PoolArena>()) {}
+
+    template <typename U>
+    PoolAllocator(const PoolAllocator<U, MaxBlocksPerChunk>& other) : PoolAllocator(other.arena) {}
+
+    PoolAllocator select_on_container_copy_construction() const {
+        return PoolAllocator();
+    }
+
+    T* allocate(size_t count) {
+        if (count != 1) {
+            return std::allocator<T>().allocate(count);
+        }
+        return static_cast<T*>(pool->allocate());
+    }
+
+    void deallocate(T* ptr, size_t count) {
+        if (count != 1) {
+            std::allocator<T>().deallocate(ptr, count);
+            return;
+        }
+        pool->deallocate(ptr);
+    }
+
+    size_t live_blocks() const {
+        return pool->live_blocks();
+    }
+
+    void release() {
+        pool->release();
+    }
+
+    size_t trim() {
+        return pool->trim();
+    }
+
+    size_t reserved_bytes() const {
+        return pool->reserved_bytes();
+    }
+
+    template <typename U>
+    bool operator==(const PoolAllocator<U, MaxBlocksPerChunk>& other) const {
+        return arena == other.arena;
+    }
+
+private:
+    template <typename U, size_t OtherMaxBlocksPerChunk>
+    friend class PoolAllocator;
+
+    explicit PoolAllocator(std::shared_ptr<detail::PoolArena> arena) :
+            arena(std::move(arena)),
+            pool(this->arena->pool_for(sizeof(T), alignof(T), MaxBlocksPerChunk)) {}
+
+    std::shared_ptr<detail::PoolArena> arena;
+    detail::FixedPool* pool;
+};
+
+template <typename Alloc>
+concept ReleasableAllocator = requires(Alloc alloc) {
+    { alloc.live_blocks() } -> std::convertible_to<size_t>;
+    alloc.release();
+};
+
+template <typename Alloc>
+concept TrimmableAllocator = requires(Alloc alloc) {
+    { alloc.trim() } -> std::convertible_to<size_t>;
+};
+
+struct MapStats {
+    size_t lookups = 0;
+    size_t probes = 0;
+    size_t max_probes = 0;
+    size_t rehashes = 0;
+    size_t nodes_moved = 0;
+    size_t allocations = 0;
+    size_t discarded_nodes = 0;
+    size_t max_chain_length = 0;
+    double average_chain_length = 0;
+};
+
+class NoStats {
+public:
+    void on_lookup(size_t /*probes*/) {}
+    void on_rehash() {}
+    void on_nodes_moved(size_t /*count*/) {}
+    void on_allocation() {}
+    void on_discard() {}
+};
+
+// the counters are relaxed atomics, so const lookups may run concurrently; a snapshot
+// taken while other threads look up keys isn't consistent across fields
+class CountingStats {
+public:
+    CountingStats() = default;
+
+    CountingStats(const CountingStats& other) {
+        *this = other;
+    }
+
+    CountingStats& operator=(const CountingStats& other) {
+        MapStats copy = other.snapshot();
+        lookups.store(copy.lookups, std::memory_order_relaxed);
+        probes.store(copy.probes, std::memory_order_relaxed);
+        max_probes.store(copy.max_probes, std::memory_order_relaxed);
+        rehashes.store(copy.rehashes, std::memory_order_relaxed);
+        nodes_moved.store(copy.nodes_moved, std::memory_order_relaxed);
+        allocations.store(copy.allocations, std::memory_order_relaxed);
+        discarded_nodes.store(copy.discarded_nodes, std::memory_order_relaxed);
+        return *this;
+    }
+
+    void on_lookup(size_t count) {
+        lookups.fetch_add(1, std::memory_order_relaxed);
+        probes.fetch_add(count, std::memory_order_relaxed);
+        size_t seen = max_probes.load(std::memory_order_relaxed);
+        while (seen < count && !max_probes.compare_exchange_weak(seen, count, std::memory_order_relaxed)) {
+        }
+    }
+
+    void on_rehash() {
+        rehashes.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void on_nodes_moved(size_t count) {
+        nodes_moved.fetch_add(count, std::memory_order_relaxed);
+    }
+
+    void on_allocation() {
+        allocations.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void on_discard() {
+        discarded_nodes.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    MapStats snapshot() const {
+        MapStats result;
+        result.lookups = lookups.load(std::memory_order_relaxed);
+        result.probes = probes.load(std::memory_order_relaxed);
+        result.max_probes = max_probes.load(std::memory_order_relaxed);
+        result.rehashes = rehashes.load(std::memory_order_relaxed);
+        result.nodes_moved = nodes_moved.load(std::memory_order_relaxed);
+        result.allocations = allocations.load(std::memory_order_relaxed);
+        result.discarded_nodes = discarded_nodes.load(std::memory_order_relaxed);
+        return result;
+    }
+
+private:
+    std::atomic<size_t> lookups = 0;
+    std::atomic<size_t> probes = 0;
+    std::atomic<size_t> max_probes = 0;
+    std::atomic<size_t> rehashes = 0;
+    std::atomic<size_t> nodes_moved = 0;
+    std::atomic<size_t> allocations = 0;
+    std::atomic<size_t> discarded_nodes = 0;
+};
+
+struct BucketDiagnostics {
+    std::vector<size_t> chain_length_histogram;
+    size_t buckets_examined = 0;
+    double empty_fraction = 0;
+    // chi-squared statistic of chain lengths per degree of freedom: about 1 for a
+    // uniformly distributing hash, much larger when keys cluster
+    double chi_squared = 0;
+};
+
+template <typename Stats>
+concept CollectsStats = requires(const Stats& stats) {
+    { stats.snapshot() } -> std::same_as<MapStats>;
+};
+
+// whether nodes store the full hash of their key; specialize to std::false_type
+// for keys that are cheaper to rehash than the 8 bytes per node are worth
+template <typename Key, typename Hash>
+struct CacheHash : std::bool_constant<!(std::is_same_v<Hash, std::hash<Key>> &&
+                                        (std::is_arithmetic_v<Key> || std::is_enum_v<Key> ||
+                                         std::is_pointer_v<Key>))> {};
 
 template <typename Key, typename Value, typename Hash, typename KeyEqual, typename Allocator>
 class ForwardList {
 protected:
     using value_type = std::pair<const Key, Value>;
+    static constexpr bool cache_hash = CacheHash<Key, Hash>::value;
+
     struct BaseNode {
         BaseNode* next = nullptr;
     };
 
+    struct NoHash {};
+
     struct Node : BaseNode {
-        std::pair<Key, Value> data;
-        size_t hash;
+        value_type data;
+        [[ no_unique_address ]] std::conditional_t<cache_hash, size_t, NoHash> hash;
     };
 
-    size_t get_hash(BaseNode* it) {
-        return static_cast<Node*>(it)->hash;
+    size_t get_hash(BaseNode* it) const {
+        if constexpr (cache_hash) {
+            return static_cast<Node*>(it)->hash;
+        } else {
+            return hash_func(get_key(it));
+        }
+    }
+
+    void set_hash(BaseNode* it, size_t hash) {
+        if constexpr (cache_hash) {
+            static_cast<Node*>(it)->hash = hash;
+        }
+    }
+
+    // cheap rejection before KeyEqual; without a cached hash there is nothing cheaper than the compare itself
+    bool hash_matches(BaseNode* it, size_t hash) const {
+        if constexpr (cache_hash) {
+            return static_cast<Node*>(it)->hash == hash;
+        } else {
+            return true;
+        }
     }
 
-    Key& get_key(BaseNode* it) {
+    const Key& get_key(BaseNode* it) const {
         return static_cast<Node*>(it)->data.first;
     }
 
-    value_type& get_data(BaseNode* it) {
-        return reinterpret_cast<value_type&>(static_cast<Node*>(it)->data);
+    value_type& get_data(BaseNode* it) const {
+        return static_cast<Node*>(it)->data;
     }
 
     using Alloc = typename std::allocator_traits<Allocator>::template rebind_alloc<value_type>;
@@ -39,12 +649,27 @@ protected:
     BaseNode fake_node;
     size_t sz = 0;
 
+    static constexpr bool trivially_destroyed = std::is_trivially_destructible_v<value_type> &&
+                                                !requires(Alloc a, value_type* p) { a.destroy(p); };
+
     void delete_node(BaseNode* ptr) {
         Node* it = static_cast<Node*>(ptr);
-        std::allocator_traits<Alloc>::destroy(alloc, &get_data(it));
+        if constexpr (!trivially_destroyed) {
+            std::allocator_traits<Alloc>::destroy(alloc, &get_data(it));
+        }
         std::allocator_traits<NodeAlloc>::deallocate(node_alloc, it, 1);
     }
 
+    // unlike destroy() this hands every node back to the allocator one by one, so a pool
+    // keeps its chunks for the next refill
+    void clear_nodes() {
+        for (BaseNode* it = fake_node.next; it;) {
+            delete_node(std::exchange(it, it->next));
+        }
+        fake_node.next = nullptr;
+        sz = 0;
+    }
+
 private:
     template <typename... Args>
     Node* place_construct(Args&&... args) {
@@ -62,7 +687,7 @@ protected:
     Node* copy_node(BaseNode* copy, BaseNode* next = nullptr) {
         Node* ptr = place_construct(get_data(copy));
         ptr->next = next;
-        ptr->hash = get_hash(copy);
+        set_hash(ptr, get_hash(copy));
         return ptr;
     }
 
@@ -70,7 +695,7 @@ protected:
     Node* emplace_new_node(Args&&... args) {
         Node* ptr = place_construct(std::forward<Args>(args)...);
         try {
-            ptr->hash = hash_func(ptr->data.first);
+            set_hash(ptr, hash_func(ptr->data.first));
         } catch (...) {
             delete_node(ptr);
             throw;
@@ -78,6 +703,13 @@ protected:
         return ptr;
     }
 
+    template <typename... Args>
+    Node* emplace_hashed_node(size_t hash, Args&&... args) {
+        Node* ptr = place_construct(std::forward<Args>(args)...);
+        set_hash(ptr, hash);
+        return ptr;
+    }
+
     BaseNode* insert_next(BaseNode* it, BaseNode* elem) {
         elem->next = it->next;
         it->next = elem;
@@ -85,6 +717,12 @@ protected:
     }
 
     void destroy() {
+        if constexpr (ReleasableAllocator<NodeAlloc> && std::is_trivially_destructible_v<value_type>) {
+            if (fake_node.next && node_alloc.live_blocks() == sz) {
+                node_alloc.release();
+                return;
+            }
+        }
         BaseNode* it = fake_node.next;
         while (it) {
             BaseNode* tmp = it;
@@ -93,7 +731,7 @@ protected:
         }
     }
 
-    ForwardList() {}
+    ForwardList() : ForwardList(Allocator()) {}
 
     explicit ForwardList(const Allocator& alloc) :  alloc(alloc),
                                                     node_alloc(alloc) {
@@ -148,14 +786,6 @@ protected:
         moveList(std::move(copy));
     }
 
-    ForwardList& operator=(const ForwardList& copy) {
-        ForwardList res(copy, std::allocator_traits<Allocator>::propagate_on_container_copy_assignment::value ?
-                              copy.alloc : alloc);
-        fake_node.next = res.fake_node.next;
-        res.fake_node.next = nullptr;
-        return *this;
-    }
-
     ForwardList& operator=(ForwardList&& copy) noexcept {
         if (this == &copy) {
             return *this;
@@ -186,7 +816,7 @@ protected:
         }
 
         value_type& operator*() const {
-            return reinterpret_cast<value_type&>(static_cast<Node*>(item)->data);
+            return static_cast<Node*>(item)->data;
         }
 
         value_type* operator->() const {
@@ -222,7 +852,9 @@ template <typename Key,
         typename Value,
         typename Hash = std::hash<Key>,
         typename KeyEqual = std::equal_to<Key>,
-        typename Allocator = std::allocator<std::pair<const Key, Value>>>
+        typename Allocator = std::allocator<std::pair<const Key, Value>>,
+        typename BucketPolicy = ModuloBucketPolicy,
+        typename StatsPolicy = NoStats>
 class UnorderedMap : protected ForwardList<Key, Value, Hash, KeyEqual, Allocator> {
 private:
     using List = ForwardList<Key, Value, Hash, KeyEqual, Allocator>;
@@ -241,6 +873,120 @@ public:
     using iterator = typename List::iterator;
     using const_iterator =  typename List::const_iterator;
 
+    class node_type {
+        using Node = typename List::Node;
+        using NodeAlloc = typename List::NodeAlloc;
+        using Alloc = typename List::Alloc;
+        using Staged = std::pair<Key, Value>;
+        using StagedAlloc = typename std::allocator_traits<Allocator>::template rebind_alloc<Staged>;
+
+    public:
+        using key_type = Key;
+        using mapped_type = Value;
+        using allocator_type = Allocator;
+
+        node_type() = default;
+
+        node_type(node_type&& other) noexcept : node(std::exchange(other.node, nullptr)),
+                                                staged(std::exchange(other.staged, nullptr)),
+                                                node_alloc(std::move(other.node_alloc)) {
+            other.node_alloc.reset();
+        }
+
+        node_type& operator=(node_type&& other) noexcept {
+            if (&other != this) {
+                reset();
+                node = std::exchange(other.node, nullptr);
+                staged = std::exchange(other.staged, nullptr);
+                node_alloc = std::move(other.node_alloc);
+                other.node_alloc.reset();
+            }
+            return *this;
+        }
+
+        ~node_type() {
+            reset();
+        }
+
+        bool empty() const {
+            return node == nullptr && staged == nullptr;
+        }
+
+        explicit operator bool() const {
+            return !empty();
+        }
+
+        allocator_type get_allocator() const {
+            return allocator_type(*node_alloc);
+        }
+
+        // the key inside a node is const, so the first call copies it and moves the mapped value
+        // into a separate pair<Key, Value>; insert then builds a new node from that pair
+        Key& key() {
+            if (!staged) {
+                stage();
+            }
+            return staged->first;
+        }
+
+        const Key& key() const {
+            return staged ? staged->first : node->data.first;
+        }
+
+        Value& mapped() const {
+            return staged ? staged->second : node->data.second;
+        }
+
+    private:
+        friend class UnorderedMap;
+
+        node_type(Node* node, const NodeAlloc& alloc) : node(node), node_alloc(alloc) {}
+
+        void stage() {
+            StagedAlloc alloc(*node_alloc);
+            Staged* pair = std::allocator_traits<StagedAlloc>::allocate(alloc, 1);
+            try {
+                std::allocator_traits<StagedAlloc>::construct(alloc, pair, node->data.first,
+                                                              std::move(node->data.second));
+            } catch (...) {
+                std::allocator_traits<StagedAlloc>::deallocate(alloc, pair, 1);
+                throw;
+            }
+            release_node();
+            staged = pair;
+        }
+
+        void release_node() {
+            Alloc alloc(*node_alloc);
+            std::allocator_traits<Alloc>::destroy(alloc, &node->data);
+            std::allocator_traits<NodeAlloc>::deallocate(*node_alloc, node, 1);
+            node = nullptr;
+        }
+
+        void reset() {
+            if (node) {
+                release_node();
+            }
+            if (staged) {
+                StagedAlloc alloc(*node_alloc);
+                std::allocator_traits<StagedAlloc>::destroy(alloc, staged);
+                std::allocator_traits<StagedAlloc>::deallocate(alloc, staged, 1);
+                staged = nullptr;
+            }
+            node_alloc.reset();
+        }
+
+        Node* node = nullptr;
+        Staged* staged = nullptr;
+        std::optional<NodeAlloc> node_alloc;
+    };
+
+    struct insert_return_type {
+        iterator position;
+        bool inserted;
+        node_type node;
+    };
+
 private:
     using List::hash_func;
     using List::cmp_equal;
@@ -252,28 +998,188 @@ private:
 
     using List::get_data;
     using List::get_key;
+    using List::set_hash;
+    using List::hash_matches;
     using List::insert_next;
     using List::delete_node;
     using List::emplace_new_node;
+    using List::emplace_hashed_node;
 
     using NodePtrAlloc = typename std::allocator_traits<Allocator>::template rebind_alloc<BaseNode*>;
     [[ no_unique_address ]] NodePtrAlloc node_ptr_alloc;
 
-    size_t bucket_count = 1;
-    BaseNode** arr = std::allocator_traits<NodePtrAlloc>::allocate(node_ptr_alloc, bucket_count);
+    BucketPolicy policy = BucketPolicy(1);
+    size_t arr_size = policy.bucket_count();
+    // arr keeps its allocation across shrinking rehashes, so it may be longer than arr_size
+    size_t arr_capacity = arr_size;
+    BaseNode** arr = std::allocator_traits<NodePtrAlloc>::allocate(node_ptr_alloc, arr_capacity);
 
     float max_load = 1.0;
+    float min_load = 0;
+    // bucket count asked for by the last reserve(); automatic shrinking doesn't go below it
+    size_t reserved_buckets = 0;
+
+    BucketPolicy old_policy = BucketPolicy(1);
+    size_t old_arr_size = 0;
+    size_t old_arr_capacity = 0;
+    BaseNode** old_arr = nullptr;
+    size_t rehash_cursor = 0;
+    size_t rehash_step = 0;
 
-    size_t get_hash(BaseNode* it) {
-        return List::get_hash(it) % bucket_count;
+    [[ no_unique_address ]] mutable StatsPolicy stats_policy;
+
+    size_t get_hash(BaseNode* it) const {
+        return policy.index(List::get_hash(it));
     }
 
-    void fixed_rehash(size_t count) {
+    bool rehashing() const {
+        return rehash_cursor < old_arr_size;
+    }
+
+    BaseNode** bucket_of(size_t hash) const {
+        if (rehashing()) {
+            size_t old_index = old_policy.index(hash);
+            if (old_index >= rehash_cursor) {
+                return old_arr + old_index;
+            }
+        }
+        return arr + policy.index(hash);
+    }
+
+    BaseNode** bucket_of(BaseNode* it) const {
+        return bucket_of(List::get_hash(it));
+    }
+
+    void retarget_bucket(BaseNode* it, BaseNode* from, BaseNode* to) {
+        BaseNode** bucket = bucket_of(it);
+        if (*bucket == from) {
+            *bucket = to;
+        }
+    }
+
+    void link_node(BaseNode* elem) {
+        BaseNode** bucket = bucket_of(elem);
+        if (!*bucket) {
+            if (fake_node.next) {
+                retarget_bucket(fake_node.next, &fake_node, elem);
+            }
+            *bucket = &fake_node;
+        }
+        insert_next(*bucket, elem);
+    }
+
+    void unlink_node(BaseNode* elem) {
+        BaseNode** bucket = bucket_of(elem);
+        BaseNode* it = *bucket;
+        while (it->next != elem) {
+            it = it->next;
+        }
+        BaseNode* next_elem = elem->next;
+        it->next = next_elem;
+        if (next_elem) {
+            retarget_bucket(next_elem, elem, it);
+        }
+        it = (*bucket)->next;
+        if (!it || bucket_of(it) != bucket) {
+            *bucket = nullptr;
+        }
+    }
+
+    void migrate_next_bucket() {
+        BaseNode** bucket = old_arr + rehash_cursor;
+        BaseNode* prev = *bucket;
+        if (!prev) {
+            ++rehash_cursor;
+            return;
+        }
+        BaseNode* first = prev->next;
+        BaseNode* last = first;
+        while (last->next && bucket_of(last->next) == bucket) {
+            last = last->next;
+        }
+        BaseNode* next_elem = last->next;
+        prev->next = next_elem;
+        last->next = nullptr;
+        *bucket = nullptr;
+        ++rehash_cursor;
+        if (next_elem) {
+            retarget_bucket(next_elem, last, prev);
+        }
+        size_t moved = 0;
+        while (first) {
+            BaseNode* cur = first;
+            first = first->next;
+            link_node(cur);
+            ++moved;
+        }
+        stats_policy.on_nodes_moved(moved);
+    }
+
+    void release_old_buckets() {
+        std::allocator_traits<NodePtrAlloc>::deallocate(node_ptr_alloc, old_arr, old_arr_capacity);
+        old_arr = nullptr;
+        old_arr_size = 0;
+        old_arr_capacity = 0;
+        rehash_cursor = 0;
+    }
+
+    void advance_rehash() {
+        for (size_t i = 0; i < rehash_step && rehashing(); ++i) {
+            migrate_next_bucket();
+        }
+        if (old_arr && !rehashing()) {
+            release_old_buckets();
+        }
+    }
+
+    void finish_rehash() {
+        while (rehashing()) {
+            migrate_next_bucket();
+        }
+        if (old_arr) {
+            release_old_buckets();
+        }
+    }
+
+    void start_rehash(size_t count) {
+        finish_rehash();
+        BucketPolicy new_policy(count);
+        count = new_policy.bucket_count();
         auto new_arr = std::allocator_traits<NodePtrAlloc>::allocate(node_ptr_alloc, count);
-        std::allocator_traits<NodePtrAlloc>::deallocate(node_ptr_alloc, arr, bucket_count);
+        std::fill(new_arr, new_arr + count, nullptr);
+        old_policy = policy;
+        old_arr_size = arr_size;
+        old_arr_capacity = arr_capacity;
+        old_arr = arr;
+        rehash_cursor = 0;
+        policy = new_policy;
+        arr_size = count;
+        arr_capacity = count;
         arr = new_arr;
-        bucket_count = count;
-        std::fill(arr, arr + bucket_count, nullptr);
+        stats_policy.on_rehash();
+    }
+
+    void fixed_rehash(size_t count) {
+        finish_rehash();
+        BucketPolicy new_policy(count);
+        count = new_policy.bucket_count();
+        if (count > arr_capacity) {
+            auto new_arr = std::allocator_traits<NodePtrAlloc>::allocate(node_ptr_alloc, count);
+            std::allocator_traits<NodePtrAlloc>::deallocate(node_ptr_alloc, arr, arr_capacity);
+            arr = new_arr;
+            arr_capacity = count;
+        }
+        arr_size = count;
+        policy = new_policy;
+        relink_buckets();
+        stats_policy.on_rehash();
+        stats_policy.on_nodes_moved(sz);
+    }
+
+    // rebuilds arr from the list in one pass using the cached hashes; the list
+    // doesn't have to be grouped by bucket beforehand
+    void relink_buckets() {
+        std::fill(arr, arr + arr_size, nullptr);
         BaseNode* last = &fake_node;
         for (BaseNode* it = fake_node.next; it;) {
             BaseNode* cur = it;
@@ -290,26 +1196,78 @@ private:
         last->next = nullptr;
     }
 
+    // after fake_node changed owners the first bucket still points at the previous owner's sentinel
+    void adopt_fake_node(BaseNode* previous) {
+        if (fake_node.next) {
+            retarget_bucket(fake_node.next, previous, &fake_node);
+        }
+    }
+
+    static constexpr float max_to_min_load_ratio = 4;
+
+    // a shrink leaves the table half full, so a bound above a quarter of max_load
+    // would let the next growth trigger another shrink
+    float shrink_threshold() const {
+        return std::min(min_load, max_load / max_to_min_load_ratio);
+    }
+
+    void automatic_rehash(size_t count) {
+        if (rehash_step == 0) {
+            fixed_rehash(count);
+        } else {
+            start_rehash(count);
+        }
+    }
+
     void reallocate() {
+        advance_rehash();
         if (load_factor() > max_load) {
-            fixed_rehash(2 * bucket_count);
+            automatic_rehash(2 * arr_size);
+        } else if (load_factor() < shrink_threshold() && arr_size > reserved_buckets) {
+            // a fixed shrink keeps the array's capacity for the next growth; only shrink_to_fit() gives it back
+            automatic_rehash(std::max(static_cast<size_t>(2 * static_cast<float>(sz) / max_load) + 1, reserved_buckets));
+        }
+    }
+
+    // shrinking is best effort: if the smaller array can't be allocated the map keeps the larger one
+    void release_spare_buckets() {
+        if (arr_capacity == arr_size) {
+            return;
+        }
+        BaseNode** new_arr;
+        try {
+            new_arr = std::allocator_traits<NodePtrAlloc>::allocate(node_ptr_alloc, arr_size);
+        } catch (const std::bad_alloc&) {
+            return;
         }
+        std::copy(arr, arr + arr_size, new_arr);
+        std::allocator_traits<NodePtrAlloc>::deallocate(node_ptr_alloc, arr, arr_capacity);
+        arr = new_arr;
+        arr_capacity = arr_size;
     }
 
 public:
-    UnorderedMap() {
-        arr[0] = nullptr;
+    UnorderedMap() : UnorderedMap(Allocator()) {}
+
+    UnorderedMap(const Allocator &alloc) : List(alloc), node_ptr_alloc(alloc) {
+        std::fill(arr, arr + arr_size, nullptr);
     }
 
-    UnorderedMap(const Allocator &alloc) : List(alloc) {
-        std::fill(arr, arr + bucket_count, nullptr);
+    template <std::input_iterator InputIt>
+    UnorderedMap(InputIt first, InputIt last, const Allocator& alloc = Allocator()) : UnorderedMap(alloc) {
+        insert_nodes(first, last);
     }
 
     UnorderedMap(const UnorderedMap& copy, const Allocator& alloc) :
             List(copy, alloc),
-            bucket_count(copy.bucket_count),
-            max_load(copy.max_load) {
-        std::fill(arr, arr + bucket_count, nullptr);
+            node_ptr_alloc(alloc),
+            policy(copy.policy),
+            arr_size(copy.arr_size),
+            max_load(copy.max_load),
+            min_load(copy.min_load),
+            reserved_buckets(copy.reserved_buckets),
+            rehash_step(copy.rehash_step) {
+        relink_buckets();
     }
 
     UnorderedMap(const UnorderedMap& copy) : UnorderedMap(copy,
@@ -317,30 +1275,37 @@ public:
 
     UnorderedMap(UnorderedMap&& copy) : List(std::move(copy)),
                                         node_ptr_alloc(std::move(copy.node_ptr_alloc)),
-                                        bucket_count(copy.bucket_count),
+                                        policy(copy.policy),
+                                        arr_size(copy.arr_size),
+                                        arr_capacity(copy.arr_capacity),
                                         arr(copy.arr),
-                                        max_load(copy.max_load) {
+                                        max_load(copy.max_load),
+                                        min_load(copy.min_load),
+                                        reserved_buckets(copy.reserved_buckets),
+                                        old_policy(copy.old_policy),
+                                        old_arr_size(copy.old_arr_size),
+                                        old_arr_capacity(copy.old_arr_capacity),
+                                        old_arr(copy.old_arr),
+                                        rehash_cursor(copy.rehash_cursor),
+                                        rehash_step(copy.rehash_step),
+                                        stats_policy(copy.stats_policy) {
+        adopt_fake_node(&copy.fake_node);
         copy.arr = nullptr;
-        copy.bucket_count = 0;
+        copy.arr_size = 0;
+        copy.arr_capacity = 0;
+        copy.old_arr = nullptr;
+        copy.old_arr_size = 0;
+        copy.old_arr_capacity = 0;
+        copy.rehash_cursor = 0;
     }
 
     UnorderedMap& operator=(const UnorderedMap& copy) {
         if (&copy == this) {
             return *this;
         }
-        auto new_arr = std::allocator_traits<NodePtrAlloc>::allocate(node_ptr_alloc, copy.bucket_count);
-        try {
-            List::operator=(copy);
-        } catch (...) {
-            std::allocator_traits<NodePtrAlloc>::deallocate(node_ptr_alloc, new_arr, copy.bucket_count);
-            throw;
-        }
-        std::allocator_traits<NodePtrAlloc>::deallocate(node_ptr_alloc, arr, bucket_count);
-        bucket_count = copy.bucket_count;
-        arr = new_arr;
-        std::copy(copy.arr, copy.arr + bucket_count, arr);
-        max_load = copy.max_load;
-        return *this;
+        constexpr bool propagate = std::allocator_traits<Allocator>::propagate_on_container_copy_assignment::value;
+        UnorderedMap res(copy, propagate ? Allocator(copy.node_alloc) : Allocator(List::node_alloc));
+        return *this = std::move(res);
     }
 
     UnorderedMap& operator=(UnorderedMap&& copy) {
@@ -348,12 +1313,33 @@ public:
             return *this;
         }
         List::operator=(std::move(copy));
-        std::allocator_traits<NodePtrAlloc>::deallocate(node_ptr_alloc, arr, bucket_count);
-        bucket_count = copy.bucket_count;
+        std::allocator_traits<NodePtrAlloc>::deallocate(node_ptr_alloc, arr, arr_capacity);
+        if (old_arr) {
+            release_old_buckets();
+        }
+        node_ptr_alloc = std::move(copy.node_ptr_alloc);
+        policy = copy.policy;
+        arr_size = copy.arr_size;
+        arr_capacity = copy.arr_capacity;
         arr = copy.arr;
         max_load = copy.max_load;
+        min_load = copy.min_load;
+        reserved_buckets = copy.reserved_buckets;
+        old_policy = copy.old_policy;
+        old_arr_size = copy.old_arr_size;
+        old_arr_capacity = copy.old_arr_capacity;
+        old_arr = copy.old_arr;
+        rehash_cursor = copy.rehash_cursor;
+        rehash_step = copy.rehash_step;
+        stats_policy = copy.stats_policy;
+        adopt_fake_node(&copy.fake_node);
         copy.arr = nullptr;
-        copy.bucket_count = 0;
+        copy.arr_size = 0;
+        copy.arr_capacity = 0;
+        copy.old_arr = nullptr;
+        copy.old_arr_size = 0;
+        copy.old_arr_capacity = 0;
+        copy.rehash_cursor = 0;
         return *this;
     }
 
@@ -366,13 +1352,95 @@ public:
     }
 
     float load_factor() const {
-        return static_cast<float>(sz) / static_cast<float>(bucket_count);
+        return static_cast<float>(sz) / static_cast<float>(arr_size);
+    }
+
+    size_t bucket_count() const {
+        return arr_size;
+    }
+
+    // while an incremental rehash is running the elements of bucket n may still sit
+    // in the old table, so those buckets are scanned too
+    size_t bucket_size(size_t n) const {
+        size_t count = 0;
+        for (BaseNode* it = arr[n] ? arr[n]->next : nullptr; it && bucket_of(it) == arr + n; it = it->next) {
+            ++count;
+        }
+        for (size_t i = rehash_cursor; i < old_arr_size; ++i) {
+            BaseNode** bucket = old_arr + i;
+            for (BaseNode* it = *bucket ? (*bucket)->next : nullptr; it && bucket_of(it) == bucket; it = it->next) {
+                if (get_hash(it) == n) {
+                    ++count;
+                }
+            }
+        }
+        return count;
+    }
+
+    size_t bucket(const Key& key) const {
+        return policy.index(hash_func(key));
+    }
+
+    BucketDiagnostics diagnostics(size_t sample_buckets = 0) const {
+        BucketDiagnostics result;
+        size_t examined = sample_buckets == 0 ? arr_size : std::min(sample_buckets, arr_size);
+        if (examined == 0) {
+            return result;
+        }
+        std::vector<size_t> lengths;
+        if (rehashing()) {
+            lengths.resize(arr_size);
+            for (BaseNode* it = fake_node.next; it; it = it->next) {
+                ++lengths[get_hash(it)];
+            }
+        }
+        size_t total = 0;
+        for (size_t i = 0; i < examined; ++i) {
+            size_t index = i * arr_size / examined;
+            size_t length = lengths.empty() ? bucket_size(index) : lengths[index];
+            if (length >= result.chain_length_histogram.size()) {
+                result.chain_length_histogram.resize(length + 1);
+            }
+            ++result.chain_length_histogram[length];
+            total += length;
+        }
+        result.buckets_examined = examined;
+        result.empty_fraction = static_cast<double>(result.chain_length_histogram[0]) / static_cast<double>(examined);
+        double expected = static_cast<double>(total) / static_cast<double>(examined);
+        if (total == 0 || examined == 1) {
+            return result;
+        }
+        for (size_t length = 0; length < result.chain_length_histogram.size(); ++length) {
+            double deviation = static_cast<double>(length) - expected;
+            result.chi_squared += static_cast<double>(result.chain_length_histogram[length]) * deviation * deviation;
+        }
+        result.chi_squared /= expected * static_cast<double>(examined - 1);
+        return result;
     }
 
     float max_load_factor() const {
         return max_load;
     }
 
+    float min_load_factor() const {
+        return min_load;
+    }
+
+    // the map shrinks on the next insertion once the load factor falls below min(ml, max_load_factor() / 4),
+    // but not below the last reserve(); 0 disables shrinking
+    void min_load_factor(float ml) {
+        min_load = ml;
+    }
+
+    void shrink_to_fit() {
+        reserved_buckets = 0;
+        fixed_rehash(static_cast<size_t>(static_cast<float>(sz) / max_load) + 1);
+        release_spare_buckets();
+        if constexpr (TrimmableAllocator<typename List::NodeAlloc>) {
+            List::node_alloc.trim();
+        }
+    }
+
     void max_load_factor(float ml) {
         max_load = ml;
         if (load_factor() > max_load) {
@@ -386,28 +1454,130 @@ public:
         fixed_rehash(count);
     }
 
-    void reserve(size_t count) {
-        count = static_cast<size_t>(static_cast<float>(count) / max_load) + 1;
-        if (count > bucket_count) {
+    void rehash(size_t count, size_t num_threads) {
+        count = std::max(count, static_cast<size_t>(static_cast<float>(sz) / max_load) + 1);
+        if (num_threads > 1) {
+            parallel_rehash(count, num_threads);
+        } else {
             fixed_rehash(count);
         }
     }
 
+    void reserve(size_t count) {
+        reserved_buckets = reserve_buckets(count);
+    }
+
     void swap(UnorderedMap& other) {
         if constexpr (std::allocator_traits<Allocator>::propagate_on_container_swap::value) {
-            std::swap(List::alloc, List::other.alloc);
-            std::swap(List::node_alloc, List::other.node_alloc);
+            std::swap(List::alloc, other.alloc);
+            std::swap(List::node_alloc, other.node_alloc);
             std::swap(node_ptr_alloc, other.node_ptr_alloc);
         }
         std::swap(cmp_equal, other.cmp_equal);
         std::swap(fake_node, other.fake_node);
         std::swap(sz, other.sz);
 
-        std::swap(bucket_count, other.bucket_count);
+        std::swap(policy, other.policy);
+        std::swap(arr_size, other.arr_size);
+        std::swap(arr_capacity, other.arr_capacity);
         std::swap(arr, other.arr);
 
+        std::swap(old_policy, other.old_policy);
+        std::swap(old_arr_size, other.old_arr_size);
+        std::swap(old_arr_capacity, other.old_arr_capacity);
+        std::swap(old_arr, other.old_arr);
+        std::swap(rehash_cursor, other.rehash_cursor);
+        std::swap(rehash_step, other.rehash_step);
+
         std::swap(hash_func, other.hash_func);
         std::swap(max_load, other.max_load);
+        std::swap(min_load, other.min_load);
+        std::swap(reserved_buckets, other.reserved_buckets);
+        std::swap(stats_policy, other.stats_policy);
+
+        adopt_fake_node(&other.fake_node);
+        other.adopt_fake_node(&fake_node);
+    }
+
+    void incremental_rehash(size_t buckets_per_step) {
+        rehash_step = buckets_per_step;
+        if (rehash_step == 0) {
+            finish_rehash();
+        }
+    }
+
+private:
+    template <typename F>
+    void visit_run(BaseNode** bucket, F& func) const {
+        for (BaseNode* it = *bucket ? (*bucket)->next : nullptr; it && bucket_of(it) == bucket; it = it->next) {
+            func(get_data(it));
+        }
+    }
+
+    template <typename F>
+    void for_each_bucket(F&& func, size_t num_threads) const {
+        num_threads = std::max<size_t>(num_threads, 1);
+        size_t old_count = rehashing() ? old_arr_size - rehash_cursor : 0;
+        size_t total = arr_size + old_count;
+        detail::parallel_run(num_threads, [&](size_t part) {
+            size_t end = detail::chunk_begin(total, num_threads, part + 1);
+            for (size_t i = detail::chunk_begin(total, num_threads, part); i < end; ++i) {
+                visit_run(i < arr_size ? arr + i : old_arr + rehash_cursor + (i - arr_size), func);
+            }
+        });
+    }
+
+public:
+    template <typename F>
+    void parallel_for_each(F func, size_t num_threads = std::thread::hardware_concurrency()) {
+        for_each_bucket([&func](value_type& item) { func(item); }, num_threads);
+    }
+
+    template <typename F>
+    void parallel_for_each(F func, size_t num_threads = std::thread::hardware_concurrency()) const {
+        for_each_bucket([&func](const value_type& item) { func(item); }, num_threads);
+    }
+
+#ifdef UNORDERED_MAP_ENABLE_EXECUTION
+    template <typename ExecutionPolicy, typename F>
+    requires std::is_execution_policy_v<std::remove_cvref_t<ExecutionPolicy>>
+    void for_each(ExecutionPolicy&& /*policy*/, F func) {
+        if constexpr (std::is_same_v<std::remove_cvref_t<ExecutionPolicy>, std::execution::sequenced_policy>) {
+            std::for_each(begin(), end(), std::move(func));
+        } else {
+            parallel_for_each(std::move(func));
+        }
+    }
+
+    template <typename ExecutionPolicy, typename F>
+    requires std::is_execution_policy_v<std::remove_cvref_t<ExecutionPolicy>>
+    void for_each(ExecutionPolicy&& /*policy*/, F func) const {
+        if constexpr (std::is_same_v<std::remove_cvref_t<ExecutionPolicy>, std::execution::sequenced_policy>) {
+            std::for_each(begin(), end(), std::move(func));
+        } else {
+            parallel_for_each(std::move(func));
+        }
+    }
+#endif
+
+    MapStats stats() const requires CollectsStats<StatsPolicy> {
+        MapStats result = stats_policy.snapshot();
+        size_t chains = 0;
+        size_t length = 0;
+        BaseNode** current = nullptr;
+        for (BaseNode* it = fake_node.next; it; it = it->next) {
+            BaseNode** bucket = bucket_of(it);
+            if (bucket != current) {
+                current = bucket;
+                length = 0;
+                ++chains;
+            }
+            result.max_chain_length = std::max(result.max_chain_length, ++length);
+        }
+        if (chains != 0) {
+            result.average_chain_length = static_cast<double>(sz) / static_cast<double>(chains);
+        }
+        return result;
     }
 
     iterator begin() {
@@ -432,22 +1602,112 @@ public:
     }
 
 private:
-    BaseNode* find_node(const Key& key, size_t hash) {
-        if (!arr[hash]) {
-            return nullptr;
+    template <typename K>
+    static constexpr bool is_lookup_key = std::is_same_v<K, Key> || detail::TransparentLookup<Hash, KeyEqual>;
+
+    template <typename K>
+    static constexpr bool is_erase_key = is_lookup_key<K> &&
+                                         !std::is_convertible_v<K, iterator> &&
+                                         !std::is_convertible_v<K, const_iterator>;
+
+    template <typename K>
+    BaseNode* find_node(const K& key, size_t hash) const {
+        BaseNode** bucket = bucket_of(hash);
+        return find_in_bucket(key, hash, bucket, *bucket ? (*bucket)->next : nullptr);
+    }
+
+    template <typename K>
+    BaseNode* find_in_bucket(const K& key, size_t hash, BaseNode** bucket, BaseNode* first) const {
+        size_t probes = 0;
+        for (BaseNode* it = first; it && bucket_of(it) == bucket; it = it->next) {
+            ++probes;
+            if (hash_matches(it, hash) && cmp_equal(get_data(it).first, key)) {
+                stats_policy.on_lookup(probes);
+                return it;
+            }
         }
-        BaseNode* it = arr[hash]->next;
-        while (it && get_hash(it) == hash && !cmp_equal(get_data(it).first, key)) {
-            it = it->next;
+        stats_policy.on_lookup(probes);
+        return nullptr;
+    }
+
+    template <typename K>
+    BaseNode* find_node(const K& key) const {
+        return find_node(key, hash_func(key));
+    }
+
+    template <typename K>
+    Value& at_node(const K& key) const {
+        BaseNode* it = find_node(key);
+        if (!it) {
+            throw std::out_of_range("Key doesn't exist");
         }
-        if (it && get_hash(it) == hash) {
-            return it;
-        } else {
-            return nullptr;
+        return get_data(it).second;
+    }
+
+    template <typename K>
+    // erasing by key moves an incremental rehash forward like an insertion does, so a map that stops
+    // growing still finishes it; erase(iterator) doesn't, to keep the order that loops erasing in place rely on
+    size_t erase_key(const K& key) {
+        BaseNode* it = find_node(key);
+        if (!it) {
+            return 0;
+        }
+        erase(const_iterator(it));
+        advance_rehash();
+        return 1;
+    }
+
+    static constexpr size_t batch_window = 16;
+
+    // every stage touches the whole window before the next one dereferences
+    // what it prefetched, so the cache misses of the window overlap
+    template <typename Out>
+    void find_window(std::span<const Key> keys, Out* out) const {
+        std::array<size_t, batch_window> hashes;
+        std::array<BaseNode**, batch_window> buckets;
+        std::array<BaseNode*, batch_window> nodes;
+        for (size_t i = 0; i < keys.size(); ++i) {
+            hashes[i] = hash_func(keys[i]);
+            buckets[i] = bucket_of(hashes[i]);
+            detail::prefetch(buckets[i]);
+        }
+        for (size_t i = 0; i < keys.size(); ++i) {
+            nodes[i] = *buckets[i];
+            if (nodes[i]) {
+                detail::prefetch(nodes[i]);
+            }
+        }
+        for (size_t i = 0; i < keys.size(); ++i) {
+            if (nodes[i]) {
+                nodes[i] = nodes[i]->next;
+                detail::prefetch(nodes[i]);
+            }
+        }
+        for (size_t i = 0; i < keys.size(); ++i) {
+            out[i] = Out(find_in_bucket(keys[i], hashes[i], buckets[i], nodes[i]));
+        }
+    }
+
+    template <typename Out>
+    void find_batch_into(std::span<const Key> keys, std::span<Out> out) const {
+        if (keys.size() != out.size()) {
+            throw std::invalid_argument("Output span size doesn't match the number of keys");
+        }
+        for (size_t offset = 0; offset < keys.size(); offset += batch_window) {
+            size_t count = std::min(batch_window, keys.size() - offset);
+            find_window(keys.subspan(offset, count), out.data() + offset);
         }
     }
-    BaseNode* find_node(const Key& key) {
-        return find_node(key, hash_func(key) % bucket_count);
+
+    template <typename K>
+    node_type extract_key(const K& key) {
+        BaseNode* it = find_node(key);
+        if (!it) {
+            return node_type();
+        }
+        node_type handle = extract(const_iterator(it));
+        advance_rehash();
+        return handle;
     }
 
 public:
@@ -455,8 +1715,48 @@ public:
         return iterator(find_node(key));
     }
 
+    void find_batch(std::span<const Key> keys, std::span<iterator> out) {
+        find_batch_into(keys, out);
+    }
+
+    void find_batch(std::span<const Key> keys, std::span<const_iterator> out) const {
+        find_batch_into(keys, out);
+    }
+
+    void contains_batch(std::span<const Key> keys, std::span<bool> out) const {
+        find_batch_into(keys, out);
+    }
+
     const_iterator find(const Key& key) const {
-        return const_iterator(find(key));
+        return const_iterator(find_node(key));
+    }
+
+    template <typename K> requires is_lookup_key<K>
+    iterator find(const K& key) {
+        return iterator(find_node(key));
+    }
+
+    template <typename K> requires is_lookup_key<K>
+    const_iterator find(const K& key) const {
+        return const_iterator(find_node(key));
+    }
+
+    bool contains(const Key& key) const {
+        return find_node(key) != nullptr;
+    }
+
+    template <typename K> requires is_lookup_key<K>
+    bool contains(const K& key) const {
+        return find_node(key) != nullptr;
+    }
+
+    size_t count(const Key& key) const {
+        return contains(key) ? 1 : 0;
+    }
+
+    template <typename K> requires is_lookup_key<K>
+    size_t count(const K& key) const {
+        return contains(key) ? 1 : 0;
     }
 
     template <typename Pair>
@@ -470,110 +1770,1867 @@ public:
 
     template <typename InputIt>
     void insert(InputIt first, InputIt last) {
-        auto it = first;
+        insert_nodes(first, last);
+    }
+
+    template <std::ranges::input_range Range>
+    void insert_range(Range&& range) {
+        insert_nodes(std::ranges::begin(range), std::ranges::end(range));
+    }
+
+    void merge(UnorderedMap& source) {
+        if (&source == this || source.sz == 0) {
+            return;
+        }
+        if (source.node_alloc != List::node_alloc) {
+            merge_values(source);
+            return;
+        }
+        reserve_buckets(sz + source.sz);
+        BaseNode* it = source.detach_nodes();
         try {
-            for (; it != last; ++it) {
-                insert(*it);
+            while (it) {
+                BaseNode* next_elem = it->next;
+                if (find_node(get_key(it), List::get_hash(it))) {
+                    source.link_node(it);
+                    ++source.sz;
+                } else {
+                    link_node(it);
+                    ++sz;
+                }
+                it = next_elem;
             }
         } catch (...) {
-            for (; first != it; ++first) {
-                auto iter = find(first->first);
-                if (iter.item) {
-                    erase(iter);
-                }
+            for (; it; ++source.sz) {
+                BaseNode* elem = it;
+                it = it->next;
+                source.link_node(elem);
             }
             throw;
         }
     }
 
-public:
-    template<class... Args>
-    std::pair<iterator, bool> emplace(Args &&... args) {
-        BaseNode* elem = emplace_new_node(std::forward<Args>(args)...);
-        size_t hash = get_hash(elem);
-        BaseNode* it = find_node(get_key(elem), hash);
-        if (it) {
-            delete_node(elem);
-            return {iterator(it), false};
-        }
-        if (!arr[hash]) {
-            if (fake_node.next) {
-                arr[get_hash(fake_node.next)] = elem;
-            }
-            arr[hash] = &fake_node;
-        }
-        insert_next(arr[hash], elem);
-        ++sz;
-        reallocate();
-        return {iterator(elem), true};
+    void merge(UnorderedMap&& source) {
+        merge(source);
     }
 
-    iterator erase(const_iterator pos) {
-        size_t hash = get_hash(pos.item);
-        BaseNode* it = arr[hash];
-        while (it->next != pos.item) {
-            it = it->next;
-        }
-        BaseNode* next_elem = pos.item->next;
-        it->next = next_elem;
-        if (next_elem && get_hash(next_elem) != hash) {
-            arr[get_hash(next_elem)] = it;
-        }
-        it = arr[hash]->next;
-        if (!it || get_hash(it) != hash) {
-            arr[hash] = nullptr;
+private:
+    // nodes from an unequal allocator can't be relinked here, so their values move into new nodes
+    void merge_values(UnorderedMap& source) {
+        reserve_buckets(sz + source.sz);
+        for (auto it = source.begin(); it != source.end();) {
+            if (contains(it->first)) {
+                ++it;
+            } else {
+                emplace(std::move(*it));
+                it = source.erase(it);
+            }
         }
-        delete_node(pos.item);
-        --sz;
-        return iterator(next_elem);
     }
 
-    void erase(const_iterator first, const_iterator last) {
-        for (iterator it(first.item); it != last; it = erase(it)) {}
+    size_t reserve_buckets(size_t count) {
+        count = BucketPolicy(static_cast<size_t>(static_cast<float>(count) / max_load) + 1).bucket_count();
+        if (count > arr_size) {
+            fixed_rehash(count);
+        }
+        return count;
     }
 
-    Value& operator[](const Key& key) {
-        iterator it = emplace(key, Value()).first;
-        return it->second;
+    BaseNode* detach_nodes() {
+        finish_rehash();
+        std::fill(arr, arr + arr_size, nullptr);
+        sz = 0;
+        return std::exchange(fake_node.next, nullptr);
     }
 
-    Value& operator[](Key&& key) {
-        iterator it = emplace(std::forward<Key>(key), Value()).first;
-        return it->second;
+    void delete_nodes(const std::vector<BaseNode*>& nodes, size_t from) {
+        for (size_t i = from; i < nodes.size(); ++i) {
+            delete_node(nodes[i]);
+        }
     }
 
-
-    Value& at(const Key& key) {
-        iterator it = find(key);
-        if (it.item) {
-            return it->second;
+    // a (Key, Value) pair is probed before anything is allocated; other values need a node to expose their key
+    template <typename Ref>
+    bool insert_value(Ref&& value) {
+        BaseNode* elem = nullptr;
+        if constexpr (detail::PairWithKey<Ref, Key>) {
+            size_t hash = hash_func(value.first);
+            if (find_node(value.first, hash)) {
+                return false;
+            }
+            elem = emplace_hashed_node(hash, std::forward<Ref>(value));
+            stats_policy.on_allocation();
         } else {
-            throw std::out_of_range("Key doesn't exist");
+            elem = emplace_new_node(std::forward<Ref>(value));
+            stats_policy.on_allocation();
+            if (find_node(get_key(elem), List::get_hash(elem))) {
+                delete_node(elem);
+                stats_policy.on_discard();
+                return false;
+            }
         }
+        link_node(elem);
+        ++sz;
+        return true;
     }
 
-    Value& at(const Key& key) const {
-        const_iterator it = find(key);
-        if (it.item) {
-            return it->second;
-        } else {
-            throw std::out_of_range("Key doesn't exist");
+    // sized ranges reserve for every element up front and link without checking the load factor;
+    // duplicates are rejected by a lookup in the table being filled
+    template <typename InputIt, typename Sentinel>
+    void insert_nodes(InputIt first, Sentinel last) {
+        constexpr bool sized = std::forward_iterator<InputIt> || std::sized_sentinel_for<Sentinel, InputIt>;
+        if constexpr (sized) {
+            reserve_buckets(sz + static_cast<size_t>(std::ranges::distance(first, last)));
+        }
+        for (; first != last; ++first) {
+            if (insert_value(*first) && !sized) {
+                reallocate();
+            }
+        }
+        if constexpr (sized) {
+            reallocate();
         }
     }
 
-    bool operator==(const UnorderedMap& other) {
-        if (sz != other.sz) {
-            return false;
+    static constexpr bool concurrent_allocation = std::is_same_v<Allocator, std::allocator<value_type>>;
+
+    using NodeChunks = std::vector<std::vector<BaseNode*>>;
+
+    void delete_chunks(const NodeChunks& chunks) {
+        for (const auto& chunk : chunks) {
+            delete_nodes(chunk, 0);
         }
-        for (auto it = begin(); it != end(); ++it) {
-            if (other.find(*it) == other.end()) {
-                return false;
-            }
+    }
+
+    template <typename Range>
+    void construct_chunk(Range& range, size_t first, size_t last, std::vector<BaseNode*>& chunk) {
+        using Difference = std::ranges::range_difference_t<Range>;
+        chunk.reserve(last - first);
+        for (size_t i = first; i < last; ++i) {
+            chunk.push_back(emplace_hashed_node(0, std::ranges::begin(range)[static_cast<Difference>(i)]));
         }
-        return true;
     }
 
-    ~UnorderedMap() {
-        std::allocator_traits<NodePtrAlloc>::deallocate(node_ptr_alloc, arr, bucket_count);
+    template <typename Range>
+    NodeChunks construct_nodes_parallel(Range& range, size_t num_threads) {
+        size_t count = std::ranges::size(range);
+        NodeChunks chunks(num_threads);
+        try {
+            for (size_t chunk = 0; !concurrent_allocation && chunk < num_threads; ++chunk) {
+                construct_chunk(range, detail::chunk_begin(count, num_threads, chunk),
+                                detail::chunk_begin(count, num_threads, chunk + 1), chunks[chunk]);
+            }
+            detail::parallel_run(num_threads, [&](size_t chunk) {
+                if constexpr (concurrent_allocation) {
+                    construct_chunk(range, detail::chunk_begin(count, num_threads, chunk),
+                                    detail::chunk_begin(count, num_threads, chunk + 1), chunks[chunk]);
+                }
+                for (BaseNode* node : chunks[chunk]) {
+                    set_hash(node, hash_func(get_key(node)));
+                }
+            });
+        } catch (...) {
+            delete_chunks(chunks);
+            throw;
+        }
+        for (size_t i = 0; i < count; ++i) {
+            stats_policy.on_allocation();
+        }
+        return chunks;
+    }
+
+    NodeChunks gather_nodes(size_t parts) const {
+        NodeChunks chunks(parts);
+        detail::parallel_run(parts, [&](size_t part) {
+            size_t end = detail::chunk_begin(arr_size, parts, part + 1);
+            for (size_t index = detail::chunk_begin(arr_size, parts, part); index < end; ++index) {
+                for (BaseNode* it = arr[index] ? arr[index]->next : nullptr; it && get_hash(it) == index; it = it->next) {
+                    chunks[part].push_back(it);
+                }
+            }
+        });
+        return chunks;
+    }
+
+    size_t partition_of(BaseNode* node, const BucketPolicy& target, size_t parts) const {
+        return target.index(List::get_hash(node)) * parts / target.bucket_count();
+    }
+
+    std::vector<BaseNode*> route_nodes(const NodeChunks& chunks, const BucketPolicy& target,
+                                       std::vector<size_t>& starts) const {
+        size_t parts = chunks.size();
+        std::vector<size_t> offsets(parts * parts);
+        detail::parallel_run(parts, [&](size_t chunk) {
+            for (BaseNode* node : chunks[chunk]) {
+                ++offsets[chunk * parts + partition_of(node, target, parts)];
+            }
+        });
+        starts.assign(parts + 1, 0);
+        size_t total = 0;
+        for (size_t part = 0; part < parts; ++part) {
+            starts[part] = total;
+            for (size_t chunk = 0; chunk < parts; ++chunk) {
+                total += std::exchange(offsets[chunk * parts + part], total);
+            }
+        }
+        starts[parts] = total;
+        std::vector<BaseNode*> routed(total);
+        detail::parallel_run(parts, [&](size_t chunk) {
+            for (BaseNode* node : chunks[chunk]) {
+                routed[offsets[chunk * parts + partition_of(node, target, parts)]++] = node;
+            }
+        });
+        return routed;
+    }
+
+    bool run_contains(size_t index, BaseNode* node) const {
+        for (BaseNode* it = arr[index]->next; it && get_hash(it) == index; it = it->next) {
+            if (hash_matches(it, List::get_hash(node)) && cmp_equal(get_key(it), get_key(node))) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    struct PartitionList {
+        BaseNode head;
+        BaseNode* tail = nullptr;
+        BaseNode* discarded = nullptr;
+    };
+
+    template <bool CheckDuplicates>
+    void link_partition(const std::vector<BaseNode*>& routed, size_t first, size_t last, PartitionList& list) {
+        list.tail = &list.head;
+        for (size_t i = first; i < last; ++i) {
+            BaseNode* node = routed[i];
+            size_t index = get_hash(node);
+            if (!arr[index]) {
+                arr[index] = list.tail;
+                list.tail->next = node;
+                list.tail = node;
+            } else if (CheckDuplicates && run_contains(index, node)) {
+                node->next = std::exchange(list.discarded, node);
+            } else {
+                insert_next(arr[index], node);
+            }
+        }
+        list.tail->next = nullptr;
+    }
+
+    void stitch_partitions(const std::vector<PartitionList>& lists) {
+        BaseNode* last = &fake_node;
+        for (const PartitionList& list : lists) {
+            if (list.head.next) {
+                arr[get_hash(list.head.next)] = last;
+                last->next = list.head.next;
+                last = list.tail;
+            }
+        }
+        last->next = nullptr;
+    }
+
+    template <typename Range>
+    void build_from(Range& range, size_t num_threads) {
+        reserve_buckets(std::ranges::size(range));
+        std::vector<BaseNode*> routed;
+        std::vector<size_t> starts;
+        {
+            NodeChunks chunks = construct_nodes_parallel(range, num_threads);
+            try {
+                routed = route_nodes(chunks, policy, starts);
+            } catch (...) {
+                delete_chunks(chunks);
+                throw;
+            }
+        }
+        std::vector<PartitionList> lists;
+        try {
+            lists.resize(num_threads);
+            detail::parallel_run(num_threads, [&](size_t part) {
+                link_partition<true>(routed, starts[part], starts[part + 1], lists[part]);
+            });
+            stitch_partitions(lists);
+        } catch (...) {
+            std::fill(arr, arr + arr_size, nullptr);
+            delete_nodes(routed, 0);
+            throw;
+        }
+        sz = routed.size();
+        for (const PartitionList& list : lists) {
+            for (BaseNode* node = list.discarded; node;) {
+                delete_node(std::exchange(node, node->next));
+                stats_policy.on_discard();
+                --sz;
+            }
+        }
+    }
+
+    void parallel_rehash(size_t count, size_t num_threads) {
+        finish_rehash();
+        BucketPolicy new_policy(count);
+        count = new_policy.bucket_count();
+        std::vector<size_t> starts;
+        std::vector<BaseNode*> routed = route_nodes(gather_nodes(num_threads), new_policy, starts);
+        std::vector<PartitionList> lists(num_threads);
+        auto new_arr = std::allocator_traits<NodePtrAlloc>::allocate(node_ptr_alloc, count);
+        std::fill(new_arr, new_arr + count, nullptr);
+        size_t capacity = count;
+        std::swap(arr, new_arr);
+        std::swap(arr_size, count);
+        std::swap(arr_capacity, capacity);
+        std::swap(policy, new_policy);
+        try {
+            detail::parallel_run(num_threads, [&](size_t part) {
+                link_partition<false>(routed, starts[part], starts[part + 1], lists[part]);
+            });
+        } catch (...) {
+            std::swap(arr, new_arr);
+            std::swap(arr_size, count);
+            std::swap(arr_capacity, capacity);
+            std::swap(policy, new_policy);
+            std::allocator_traits<NodePtrAlloc>::deallocate(node_ptr_alloc, new_arr, capacity);
+            throw;
+        }
+        stitch_partitions(lists);
+        std::allocator_traits<NodePtrAlloc>::deallocate(node_ptr_alloc, new_arr, capacity);
+        stats_policy.on_rehash();
+        stats_policy.on_nodes_moved(sz);
+    }
+
+public:
+    template <std::ranges::input_range Range>
+    static UnorderedMap build_parallel(Range&& range, size_t num_threads, const Allocator& alloc = Allocator()) {
+        UnorderedMap map(alloc);
+        if constexpr (std::ranges::random_access_range<Range> && std::ranges::sized_range<Range>) {
+            if (num_threads > 1) {
+                map.build_from(range, num_threads);
+                return map;
+            }
+        }
+        map.insert_range(std::forward<Range>(range));
+        return map;
+    }
+
+private:
+    template <typename... Args>
+    static constexpr bool emplaces_key() {
+        if constexpr (sizeof...(Args) == 2) {
+            return std::is_same_v<std::remove_cvref_t<std::tuple_element_t<0, std::tuple<Args...>>>, Key>;
+        } else {
+            return false;
+        }
+    }
+
+    template <typename... Args>
+    static constexpr bool emplaces_pair() {
+        if constexpr (sizeof...(Args) == 1) {
+            return detail::PairWithKey<std::tuple_element_t<0, std::tuple<Args...>>, Key>;
+        } else {
+            return false;
+        }
+    }
+
+    template <typename K, typename... Args>
+    BaseNode* insert_hashed(size_t hash, K&& key, Args&&... args) {
+        BaseNode* elem = emplace_hashed_node(hash, std::piecewise_construct,
+                                             std::forward_as_tuple(std::forward<K>(key)),
+                                             std::forward_as_tuple(std::forward<Args>(args)...));
+        stats_policy.on_allocation();
+        link_node(elem);
+        ++sz;
+        reallocate();
+        return elem;
+    }
+
+    template <typename K, typename... Args>
+    std::pair<iterator, bool> find_or_emplace(K&& key, Args&&... args) {
+        size_t hash = hash_func(key);
+        BaseNode* it = find_node(key, hash);
+        if (it) {
+            return {iterator(it), false};
+        }
+        return {iterator(insert_hashed(hash, std::forward<K>(key), std::forward<Args>(args)...)), true};
+    }
+
+    template <typename K, typename M>
+    std::pair<iterator, bool> find_or_assign(K&& key, M&& obj) {
+        size_t hash = hash_func(key);
+        BaseNode* it = find_node(key, hash);
+        if (it) {
+            get_data(it).second = std::forward<M>(obj);
+            return {iterator(it), false};
+        }
+        return {iterator(insert_hashed(hash, std::forward<K>(key), std::forward<M>(obj))), true};
+    }
+
+public:
+    template<class... Args>
+    std::pair<iterator, bool> emplace(Args &&... args) {
+        if constexpr (emplaces_key<Args...>()) {
+            return find_or_emplace(std::forward<Args>(args)...);
+        } else if constexpr (emplaces_pair<Args...>()) {
+            return emplace_pair(std::forward<Args>(args)...);
+        } else {
+            return emplace_node(std::forward<Args>(args)...);
+        }
+    }
+
+private:
+    template <typename Pair>
+    std::pair<iterator, bool> emplace_pair(Pair&& value) {
+        return find_or_emplace(std::forward<Pair>(value).first, std::forward<Pair>(value).second);
+    }
+
+    template <typename... Args>
+    std::pair<iterator, bool> emplace_node(Args&&... args) {
+        BaseNode* elem = emplace_new_node(std::forward<Args>(args)...);
+        stats_policy.on_allocation();
+        BaseNode* it = find_node(get_key(elem), List::get_hash(elem));
+        if (it) {
+            delete_node(elem);
+            stats_policy.on_discard();
+            return {iterator(it), false};
+        }
+        link_node(elem);
+        ++sz;
+        reallocate();
+        return {iterator(elem), true};
+    }
+
+public:
+    template <typename... Args>
+    std::pair<iterator, bool> try_emplace(const Key& key, Args&&... args) {
+        return find_or_emplace(key, std::forward<Args>(args)...);
+    }
+
+    template <typename... Args>
+    std::pair<iterator, bool> try_emplace(Key&& key, Args&&... args) {
+        return find_or_emplace(std::move(key), std::forward<Args>(args)...);
+    }
+
+    template <typename M>
+    std::pair<iterator, bool> insert_or_assign(const Key& key, M&& obj) {
+        return find_or_assign(key, std::forward<M>(obj));
+    }
+
+    template <typename M>
+    std::pair<iterator, bool> insert_or_assign(Key&& key, M&& obj) {
+        return find_or_assign(std::move(key), std::forward<M>(obj));
+    }
+
+    iterator erase(const_iterator pos) {
+        BaseNode* next_elem = pos.item->next;
+        unlink_node(pos.item);
+        delete_node(pos.item);
+        --sz;
+        return iterator(next_elem);
+    }
+
+    void erase(const_iterator first, const_iterator last) {
+        for (iterator it(first.item); it != last; it = erase(it)) {}
+    }
+
+    node_type extract(const_iterator pos) {
+        unlink_node(pos.item);
+        --sz;
+        return node_type(static_cast<Node*>(pos.item), List::node_alloc);
+    }
+
+    node_type extract(const Key& key) {
+        return extract_key(key);
+    }
+
+    template <typename K> requires is_erase_key<K>
+    node_type extract(const K& key) {
+        return extract_key(key);
+    }
+
+    insert_return_type insert(node_type&& handle) {
+        if (handle.empty()) {
+            return {end(), false, node_type()};
+        }
+        if (handle.staged) {
+            return insert_staged(std::move(handle));
+        }
+        BaseNode* elem = handle.node;
+        BaseNode* it = find_node(get_key(elem), List::get_hash(elem));
+        if (it) {
+            return {iterator(it), false, std::move(handle)};
+        }
+        if (*handle.node_alloc != List::node_alloc) {
+            iterator pos = emplace(std::move(get_data(elem))).first;
+            handle.reset();
+            return {pos, true, node_type()};
+        }
+        handle.node = nullptr;
+        handle.node_alloc.reset();
+        link_node(elem);
+        ++sz;
+        reallocate();
+        return {iterator(elem), true, node_type()};
+    }
+
+private:
+    insert_return_type insert_staged(node_type&& handle) {
+        auto [pos, inserted] = find_or_emplace(std::move(handle.staged->first), std::move(handle.staged->second));
+        if (!inserted) {
+            return {pos, false, std::move(handle)};
+        }
+        handle.reset();
+        return {pos, true, node_type()};
+    }
+
+public:
+    size_t erase(const Key& key) {
+        return erase_key(key);
+    }
+
+    template <typename K> requires is_erase_key<K>
+    size_t erase(const K& key) {
+        return erase_key(key);
+    }
+
+    Value& operator[](const Key& key) {
+        return try_emplace(key).first->second;
+    }
+
+    Value& operator[](Key&& key) {
+        return try_emplace(std::move(key)).first->second;
+    }
+
+
+    Value& at(const Key& key) {
+        return at_node(key);
+    }
+
+    const Value& at(const Key& key) const {
+        return at_node(key);
+    }
+
+    template <typename K> requires is_lookup_key<K>
+    Value& at(const K& key) {
+        return at_node(key);
+    }
+
+    template <typename K> requires is_lookup_key<K>
+    const Value& at(const K& key) const {
+        return at_node(key);
+    }
+
+    void clear() {
+        if (old_arr) {
+            release_old_buckets();
+        }
+        List::clear_nodes();
+        std::fill(arr, arr + arr_size, nullptr);
+    }
+
+    bool operator==(const UnorderedMap& other) const {
+        if (sz != other.sz) {
+            return false;
+        }
+        for (auto it = begin(); it != end(); ++it) {
+            auto found = other.find(it->first);
+            if (found == other.end() || !(found->second == it->second)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    ~UnorderedMap() {
+        std::allocator_traits<NodePtrAlloc>::deallocate(node_ptr_alloc, arr, arr_capacity);
+        if (old_arr) {
+            release_old_buckets();
+        }
+    }
+};
+
+namespace detail {
+
+using ctrl_t = int8_t;
+
+constexpr ctrl_t ctrl_empty = -128;
+constexpr ctrl_t ctrl_deleted = -2;
+constexpr ctrl_t ctrl_sentinel = -1;
+
+inline bool is_full(ctrl_t ctrl) {
+    return ctrl >= 0;
+}
+
+template <size_t Width, size_t Shift>
+class BitMask {
+public:
+    explicit BitMask(uint64_t mask) : mask(mask) {}
+
+    explicit operator bool() const {
+        return mask != 0;
+    }
+
+    size_t lowest() const {
+        return static_cast<size_t>(std::countr_zero(mask)) >> Shift;
+    }
+
+    size_t trailing_zeros() const {
+        return std::min(lowest(), Width);
+    }
+
+    size_t leading_zeros() const {
+        constexpr size_t unused_bits = sizeof(mask) * CHAR_BIT - (Width << Shift);
+        return (static_cast<size_t>(std::countl_zero(mask)) - unused_bits) >> Shift;
+    }
+
+    size_t operator*() const {
+        return lowest();
+    }
+
+    BitMask& operator++() {
+        mask &= mask - 1;
+        return *this;
+    }
+
+    BitMask begin() const {
+        return *this;
+    }
+
+    BitMask end() const {
+        return BitMask(0);
+    }
+
+    bool operator==(const BitMask& other) const {
+        return mask == other.mask;
+    }
+
+private:
+    uint64_t mask;
+};
+
+#ifdef UNORDERED_MAP_USE_SSE2
+class GroupSse2 {
+public:
+    static constexpr size_t width = 16;
+    using Mask = BitMask<width, 0>;
+
+    explicit GroupSse2(const ctrl_t* pos) : ctrl(_mm_loadu_si128(reinterpret_cast<const __m128i*>(pos))) {}
+
+    Mask match(ctrl_t fingerprint) const {
+        return to_mask(_mm_cmpeq_epi8(_mm_set1_epi8(fingerprint), ctrl));
+    }
+
+    Mask match_empty() const {
+        return to_mask(_mm_cmpeq_epi8(_mm_set1_epi8(ctrl_empty), ctrl));
+    }
+
+    Mask match_empty_or_deleted() const {
+        return to_mask(_mm_cmpgt_epi8(_mm_set1_epi8(ctrl_sentinel), ctrl));
+    }
+
+private:
+    static Mask to_mask(__m128i bytes) {
+        return Mask(static_cast<uint16_t>(_mm_movemask_epi8(bytes)));
+    }
+
+    __m128i ctrl;
+};
+#endif
+
+class GroupPortable {
+public:
+    static constexpr size_t width = 8;
+    using Mask = BitMask<width, 3>;
+
+    explicit GroupPortable(const ctrl_t* pos) {
+        std::memcpy(&ctrl, pos, width);
+        if constexpr (std::endian::native == std::endian::big) {
+            ctrl = __builtin_bswap64(ctrl);
+        }
+    }
+
+    Mask match(ctrl_t fingerprint) const {
+        uint64_t bytes = ctrl ^ (lsbs * static_cast<uint8_t>(fingerprint));
+        return Mask((bytes - lsbs) & ~bytes & msbs);
+    }
+
+    Mask match_empty() const {
+        constexpr int empty_shift = 6;
+        return Mask((ctrl & ~(ctrl << empty_shift)) & msbs);
+    }
+
+    Mask match_empty_or_deleted() const {
+        constexpr int empty_or_deleted_shift = 7;
+        return Mask((ctrl & ~(ctrl << empty_or_deleted_shift)) & msbs);
+    }
+
+private:
+    static constexpr uint64_t lsbs = 0x0101010101010101;
+    static constexpr uint64_t msbs = 0x8080808080808080;
+
+    uint64_t ctrl = 0;
+};
+
+#ifdef UNORDERED_MAP_USE_SSE2
+using Group = GroupSse2;
+#else
+using Group = GroupPortable;
+#endif
+
+}  // namespace detail
+
+template <typename Key,
+        typename Value,
+        typename Hash = std::hash<Key>,
+        typename KeyEqual = std::equal_to<Key>,
+        typename Allocator = std::allocator<std::pair<const Key, Value>>>
+class FlatUnorderedMap {
+public:
+    using value_type = std::pair<const Key, Value>;
+    using key_type = Key;
+    using mapped_type = Value;
+    using size_type = size_t;
+    using difference_type = ptrdiff_t;
+    using hasher = Hash;
+    using key_equal = KeyEqual;
+    using allocator_type = Allocator;
+    using reference = value_type &;
+    using const_reference = const value_type&;
+
+private:
+    using ctrl_t = detail::ctrl_t;
+    using Group = detail::Group;
+    using slot_type = std::pair<Key, Value>;
+
+    using SlotAlloc = typename std::allocator_traits<Allocator>::template rebind_alloc<slot_type>;
+    using CtrlAlloc = typename std::allocator_traits<Allocator>::template rebind_alloc<ctrl_t>;
+
+    static constexpr size_t fingerprint_bits = 7;
+    static constexpr size_t fingerprint_mask = (size_t{1} << fingerprint_bits) - 1;
+    static constexpr float default_max_load = 0.875F;
+
+    [[ no_unique_address ]] Hash hash_func;
+    [[ no_unique_address ]] KeyEqual cmp_equal;
+
+    [[ no_unique_address ]] SlotAlloc slot_alloc;
+    [[ no_unique_address ]] CtrlAlloc ctrl_alloc;
+
+    ctrl_t* ctrl = nullptr;
+    slot_type* slots = nullptr;
+    size_t capacity = 0;
+    size_t sz = 0;
+    size_t growth_left = 0;
+    float max_load = default_max_load;
+
+public:
+    template <typename U>
+    class BaseIterator {
+    public:
+        using value_type = U;
+        using pointer = value_type*;
+        using reference = value_type&;
+        using difference_type = ptrdiff_t;
+        using const_reference = const value_type &;
+        using iterator_category = std::forward_iterator_tag;
+
+    public:
+        ctrl_t* ctrl = nullptr;
+        slot_type* slot = nullptr;
+
+        BaseIterator(ctrl_t* ctrl, slot_type* slot) : ctrl(ctrl), slot(slot) {
+            if (ctrl) {
+                skip_empty();
+            }
+        }
+
+        BaseIterator() = default;
+
+        operator BaseIterator<const U>() const {
+            return BaseIterator<const U>(ctrl, slot);
+        }
+
+        value_type& operator*() const {
+            return reinterpret_cast<value_type&>(*slot);
+        }
+
+        value_type* operator->() const {
+            return &operator*();
+        }
+
+        BaseIterator& operator++() {
+            ++ctrl;
+            ++slot;
+            skip_empty();
+            return *this;
+        }
+
+        BaseIterator operator++(int) {
+            auto copy = *this;
+            ++*this;
+            return copy;
+        }
+
+        template <typename P>
+        bool operator==(const BaseIterator<P>& other) const {
+            return ctrl == other.ctrl;
+        }
+
+    private:
+        void skip_empty() {
+            while (*ctrl < detail::ctrl_sentinel) {
+                ++ctrl;
+                ++slot;
+            }
+        }
+    };
+    using iterator = BaseIterator<value_type>;
+    using const_iterator = BaseIterator<const value_type>;
+
+private:
+    static size_t probe_start(size_t hash) {
+        return hash >> fingerprint_bits;
+    }
+
+    static ctrl_t fingerprint(size_t hash) {
+        return static_cast<ctrl_t>(hash & fingerprint_mask);
+    }
+
+    static size_t normalize_capacity(size_t count) {
+        return std::max(std::bit_ceil(count + 1), Group::width) - 1;
+    }
+
+    size_t hash_of(const Key& key) const {
+        return detail::hash_mix(hash_func(key));
+    }
+
+    size_t capacity_to_growth(size_t cap) const {
+        if (cap == 0) {
+            return 0;
+        }
+        return std::min(static_cast<size_t>(static_cast<float>(cap) * max_load), cap - 1);
+    }
+
+    size_t capacity_for(size_t count) const {
+        size_t cap = normalize_capacity(static_cast<size_t>(static_cast<float>(count) / max_load));
+        while (capacity_to_growth(cap) < count) {
+            cap = 2 * cap + 1;
+        }
+        return cap;
+    }
+
+    iterator iterator_at(size_t index) const {
+        return iterator(ctrl + index, slots + index);
+    }
+
+    void set_ctrl(size_t index, ctrl_t value) {
+        ctrl[index] = value;
+        if (index < Group::width - 1) {
+            ctrl[capacity + 1 + index] = value;
+        }
+    }
+
+    size_t find_index(const Key& key, size_t hash) const {
+        if (capacity == 0) {
+            return capacity;
+        }
+        size_t pos = probe_start(hash) & capacity;
+        for (size_t step = Group::width;; step += Group::width) {
+            Group group(ctrl + pos);
+            for (size_t offset : group.match(fingerprint(hash))) {
+                size_t index = (pos + offset) & capacity;
+                if (cmp_equal(slots[index].first, key)) {
+                    return index;
+                }
+            }
+            if (group.match_empty()) {
+                return capacity;
+            }
+            pos = (pos + step) & capacity;
+        }
+    }
+
+    size_t find_first_non_full(size_t hash) const {
+        size_t pos = probe_start(hash) & capacity;
+        for (size_t step = Group::width;; step += Group::width) {
+            auto mask = Group(ctrl + pos).match_empty_or_deleted();
+            if (mask) {
+                return (pos + mask.lowest()) & capacity;
+            }
+            pos = (pos + step) & capacity;
+        }
+    }
+
+    void allocate_storage(size_t cap) {
+        ctrl_t* new_ctrl = std::allocator_traits<CtrlAlloc>::allocate(ctrl_alloc, cap + Group::width);
+        try {
+            slots = std::allocator_traits<SlotAlloc>::allocate(slot_alloc, cap);
+        } catch (...) {
+            std::allocator_traits<CtrlAlloc>::deallocate(ctrl_alloc, new_ctrl, cap + Group::width);
+            throw;
+        }
+        ctrl = new_ctrl;
+        capacity = cap;
+        std::fill(ctrl, ctrl + cap + Group::width, detail::ctrl_empty);
+        ctrl[cap] = detail::ctrl_sentinel;
+    }
+
+    void deallocate_storage(ctrl_t* old_ctrl, slot_type* old_slots, size_t cap) {
+        if (cap == 0) {
+            return;
+        }
+        std::allocator_traits<CtrlAlloc>::deallocate(ctrl_alloc, old_ctrl, cap + Group::width);
+        std::allocator_traits<SlotAlloc>::deallocate(slot_alloc, old_slots, cap);
+    }
+
+    void destroy_slots(const ctrl_t* slot_ctrl, slot_type* slot_array, size_t cap) {
+        if constexpr (!std::is_trivially_destructible_v<slot_type>) {
+            for (size_t i = 0; i < cap; ++i) {
+                if (detail::is_full(slot_ctrl[i])) {
+                    std::allocator_traits<SlotAlloc>::destroy(slot_alloc, slot_array + i);
+                }
+            }
+        }
+    }
+
+    void destroy_slots() {
+        destroy_slots(ctrl, slots, capacity);
+    }
+
+    // elements are copied unless their move can't throw, so a failure puts the old storage back untouched
+    void resize(size_t new_capacity) {
+        ctrl_t* old_ctrl = ctrl;
+        slot_type* old_slots = slots;
+        size_t old_capacity = capacity;
+        allocate_storage(new_capacity);
+        try {
+            for (size_t i = 0; i < old_capacity; ++i) {
+                if (detail::is_full(old_ctrl[i])) {
+                    size_t hash = hash_of(old_slots[i].first);
+                    size_t index = find_first_non_full(hash);
+                    std::allocator_traits<SlotAlloc>::construct(slot_alloc, slots + index,
+                                                                std::move_if_noexcept(old_slots[i]));
+                    set_ctrl(index, fingerprint(hash));
+                }
+            }
+        } catch (...) {
+            destroy_slots();
+            deallocate_storage(ctrl, slots, capacity);
+            ctrl = old_ctrl;
+            slots = old_slots;
+            capacity = old_capacity;
+            throw;
+        }
+        destroy_slots(old_ctrl, old_slots, old_capacity);
+        growth_left = capacity_to_growth(capacity) - sz;
+        deallocate_storage(old_ctrl, old_slots, old_capacity);
+    }
+
+    void grow() {
+        if (capacity > 0 && 2 * sz <= capacity_to_growth(capacity)) {
+            resize(capacity);
+        } else {
+            resize(std::max(2 * capacity + 1, capacity_for(sz + 1)));
+        }
+    }
+
+    size_t find_insert_slot(size_t hash) {
+        if (capacity == 0) {
+            grow();
+        }
+        size_t index = find_first_non_full(hash);
+        if (growth_left == 0 && ctrl[index] != detail::ctrl_deleted) {
+            grow();
+            index = find_first_non_full(hash);
+        }
+        return index;
+    }
+
+    template <typename... Args>
+    size_t insert_at(size_t hash, Args&&... args) {
+        size_t index = find_insert_slot(hash);
+        std::allocator_traits<SlotAlloc>::construct(slot_alloc, slots + index, std::forward<Args>(args)...);
+        if (ctrl[index] == detail::ctrl_empty) {
+            --growth_left;
+        }
+        set_ctrl(index, fingerprint(hash));
+        ++sz;
+        return index;
+    }
+
+    void erase_at(size_t index) {
+        std::allocator_traits<SlotAlloc>::destroy(slot_alloc, slots + index);
+        --sz;
+        size_t index_before = (index - Group::width) & capacity;
+        auto empty_after = Group(ctrl + index).match_empty();
+        auto empty_before = Group(ctrl + index_before).match_empty();
+        bool was_never_full = empty_before && empty_after &&
+                              empty_after.trailing_zeros() + empty_before.leading_zeros() < Group::width;
+        if (was_never_full) {
+            set_ctrl(index, detail::ctrl_empty);
+            ++growth_left;
+        } else {
+            set_ctrl(index, detail::ctrl_deleted);
+        }
+    }
+
+    template <typename... Args>
+    static constexpr bool emplaces_key() {
+        if constexpr (sizeof...(Args) == 2) {
+            return std::is_same_v<std::remove_cvref_t<std::tuple_element_t<0, std::tuple<Args...>>>, Key>;
+        } else {
+            return false;
+        }
+    }
+
+    template <typename... Args>
+    static constexpr bool emplaces_pair() {
+        if constexpr (sizeof...(Args) == 1) {
+            return detail::PairWithKey<std::tuple_element_t<0, std::tuple<Args...>>, Key>;
+        } else {
+            return false;
+        }
+    }
+
+    template <typename K, typename... Args>
+    std::pair<iterator, bool> find_or_emplace(K&& key, Args&&... args) {
+        size_t hash = hash_of(key);
+        size_t index = find_index(key, hash);
+        if (index != capacity) {
+            return {iterator_at(index), false};
+        }
+        index = insert_at(hash, std::piecewise_construct, std::forward_as_tuple(std::forward<K>(key)),
+                          std::forward_as_tuple(std::forward<Args>(args)...));
+        return {iterator_at(index), true};
+    }
+
+    template <typename Pair>
+    std::pair<iterator, bool> emplace_pair(Pair&& value) {
+        return find_or_emplace(std::forward<Pair>(value).first, std::forward<Pair>(value).second);
+    }
+
+    template <typename K>
+    Value& find_or_insert_default(K&& key) {
+        size_t hash = hash_of(key);
+        size_t index = find_index(key, hash);
+        if (index == capacity) {
+            index = insert_at(hash, std::piecewise_construct,
+                              std::forward_as_tuple(std::forward<K>(key)), std::tuple<>());
+        }
+        return slots[index].second;
+    }
+
+    void steal(FlatUnorderedMap& other) {
+        ctrl = std::exchange(other.ctrl, nullptr);
+        slots = std::exchange(other.slots, nullptr);
+        capacity = std::exchange(other.capacity, 0);
+        sz = std::exchange(other.sz, 0);
+        growth_left = std::exchange(other.growth_left, 0);
+        max_load = other.max_load;
+    }
+
+public:
+    FlatUnorderedMap() : FlatUnorderedMap(Allocator()) {}
+
+    FlatUnorderedMap(const Allocator& alloc) : slot_alloc(alloc), ctrl_alloc(alloc) {}
+
+    FlatUnorderedMap(const FlatUnorderedMap& copy, const Allocator& alloc) :
+            hash_func(copy.hash_func),
+            cmp_equal(copy.cmp_equal),
+            slot_alloc(alloc),
+            ctrl_alloc(alloc),
+            max_load(copy.max_load) {
+        if (copy.sz == 0) {
+            return;
+        }
+        allocate_storage(copy.capacity);
+        std::copy(copy.ctrl, copy.ctrl + capacity + Group::width, ctrl);
+        size_t index = 0;
+        try {
+            for (; index < capacity; ++index) {
+                if (detail::is_full(ctrl[index])) {
+                    std::allocator_traits<SlotAlloc>::construct(slot_alloc, slots + index, copy.slots[index]);
+                }
+            }
+        } catch (...) {
+            capacity = index;
+            destroy_slots();
+            deallocate_storage(ctrl, slots, copy.capacity);
+            throw;
+        }
+        sz = copy.sz;
+        growth_left = copy.growth_left;
+    }
+
+    FlatUnorderedMap(const FlatUnorderedMap& copy) : FlatUnorderedMap(copy,
+        std::allocator_traits<SlotAlloc>::select_on_container_copy_construction(copy.slot_alloc)) {}
+
+    FlatUnorderedMap(FlatUnorderedMap&& copy) : hash_func(std::move(copy.hash_func)),
+                                                cmp_equal(std::move(copy.cmp_equal)),
+                                                slot_alloc(std::move(copy.slot_alloc)),
+                                                ctrl_alloc(std::move(copy.ctrl_alloc)) {
+        steal(copy);
+    }
+
+    FlatUnorderedMap& operator=(const FlatUnorderedMap& copy) {
+        if (&copy == this) {
+            return *this;
+        }
+        FlatUnorderedMap res(copy, std::allocator_traits<Allocator>::propagate_on_container_copy_assignment::value ?
+                                   Allocator(copy.slot_alloc) : Allocator(slot_alloc));
+        swap(res);
+        return *this;
+    }
+
+    FlatUnorderedMap& operator=(FlatUnorderedMap&& copy) {
+        if (&copy == this) {
+            return *this;
+        }
+        destroy_slots();
+        deallocate_storage(ctrl, slots, capacity);
+        if constexpr (std::allocator_traits<Allocator>::propagate_on_container_move_assignment::value) {
+            slot_alloc = std::move(copy.slot_alloc);
+            ctrl_alloc = std::move(copy.ctrl_alloc);
+        }
+        hash_func = std::move(copy.hash_func);
+        cmp_equal = std::move(copy.cmp_equal);
+        steal(copy);
+        return *this;
+    }
+
+    size_t size() const {
+        return sz;
+    }
+
+    bool empty() const {
+        return sz == 0;
+    }
+
+    float load_factor() const {
+        if (capacity == 0) {
+            return 0;
+        }
+        return static_cast<float>(sz) / static_cast<float>(capacity);
+    }
+
+    float max_load_factor() const {
+        return max_load;
+    }
+
+    void max_load_factor(float ml) {
+        size_t old_growth = capacity_to_growth(capacity);
+        max_load = ml;
+        size_t new_growth = capacity_to_growth(capacity);
+        if (new_growth < sz) {
+            resize(capacity_for(sz));
+        } else if (new_growth >= old_growth) {
+            growth_left += new_growth - old_growth;
+        } else {
+            growth_left -= std::min(growth_left, old_growth - new_growth);
+        }
+    }
+
+    void rehash(size_t count) {
+        resize(std::max(normalize_capacity(count), capacity_for(sz)));
+    }
+
+    void reserve(size_t count) {
+        if (capacity_to_growth(capacity) < count) {
+            resize(capacity_for(count));
+        }
+    }
+
+    void swap(FlatUnorderedMap& other) {
+        if constexpr (std::allocator_traits<Allocator>::propagate_on_container_swap::value) {
+            std::swap(slot_alloc, other.slot_alloc);
+            std::swap(ctrl_alloc, other.ctrl_alloc);
+        }
+        std::swap(hash_func, other.hash_func);
+        std::swap(cmp_equal, other.cmp_equal);
+        std::swap(ctrl, other.ctrl);
+        std::swap(slots, other.slots);
+        std::swap(capacity, other.capacity);
+        std::swap(sz, other.sz);
+        std::swap(growth_left, other.growth_left);
+        std::swap(max_load, other.max_load);
+    }
+
+    iterator begin() {
+        return capacity == 0 ? end() : iterator(ctrl, slots);
+    }
+    iterator end() {
+        return iterator_at(capacity);
+    }
+
+    const_iterator begin() const {
+        return capacity == 0 ? end() : const_iterator(ctrl, slots);
+    }
+    const_iterator end() const {
+        return iterator_at(capacity);
+    }
+
+    const_iterator cbegin() const {
+        return begin();
+    }
+    const_iterator cend() const {
+        return end();
+    }
+
+    iterator find(const Key& key) {
+        return iterator_at(find_index(key, hash_of(key)));
+    }
+
+    const_iterator find(const Key& key) const {
+        return iterator_at(find_index(key, hash_of(key)));
+    }
+
+    template <typename Pair>
+    std::pair<iterator, bool> insert(Pair&& value) {
+        return emplace(std::forward<Pair>(value));
+    }
+
+    std::pair<iterator, bool> insert(const value_type& value) {
+        return insert<const_reference>(value);
+    }
+
+    template <typename InputIt>
+    void insert(InputIt first, InputIt last) {
+        for (; first != last; ++first) {
+            insert(*first);
+        }
+    }
+
+    template <typename... Args>
+    std::pair<iterator, bool> emplace(Args&&... args) {
+        if constexpr (emplaces_key<Args...>()) {
+            return find_or_emplace(std::forward<Args>(args)...);
+        } else if constexpr (emplaces_pair<Args...>()) {
+            return emplace_pair(std::forward<Args>(args)...);
+        } else {
+            slot_type value(std::forward<Args>(args)...);
+            size_t hash = hash_of(value.first);
+            size_t index = find_index(value.first, hash);
+            if (index != capacity) {
+                return {iterator_at(index), false};
+            }
+            return {iterator_at(insert_at(hash, std::move(value))), true};
+        }
+    }
+
+    iterator erase(const_iterator pos) {
+        auto index = static_cast<size_t>(pos.ctrl - ctrl);
+        erase_at(index);
+        return iterator_at(index);
+    }
+
+    void erase(const_iterator first, const_iterator last) {
+        for (iterator it(first.ctrl, first.slot); it != last; it = erase(it)) {}
+    }
+
+    Value& operator[](const Key& key) {
+        return find_or_insert_default(key);
+    }
+
+    Value& operator[](Key&& key) {
+        return find_or_insert_default(std::move(key));
+    }
+
+    Value& at(const Key& key) {
+        iterator it = find(key);
+        if (it != end()) {
+            return it->second;
+        } else {
+            throw std::out_of_range("Key doesn't exist");
+        }
+    }
+
+    const Value& at(const Key& key) const {
+        const_iterator it = find(key);
+        if (it != end()) {
+            return it->second;
+        } else {
+            throw std::out_of_range("Key doesn't exist");
+        }
+    }
+
+    bool operator==(const FlatUnorderedMap& other) const {
+        if (sz != other.sz) {
+            return false;
+        }
+        for (auto it = begin(); it != end(); ++it) {
+            auto other_it = other.find(it->first);
+            if (other_it == other.end() || !(other_it->second == it->second)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    ~FlatUnorderedMap() {
+        destroy_slots();
+        deallocate_storage(ctrl, slots, capacity);
+    }
+};
+
+template <typename Key,
+        typename Value,
+        typename Hash = std::hash<Key>,
+        typename KeyEqual = std::equal_to<Key>,
+        typename Allocator = std::allocator<std::pair<const Key, Value>>,
+        typename BucketPolicy = ModuloBucketPolicy>
+class ShardedUnorderedMap {
+public:
+    using map_type = UnorderedMap<Key, Value, Hash, KeyEqual, Allocator, BucketPolicy>;
+    using value_type = typename map_type::value_type;
+    using key_type = Key;
+    using mapped_type = Value;
+    using size_type = size_t;
+    using hasher = Hash;
+    using key_equal = KeyEqual;
+
+private:
+    static constexpr size_t cache_line_size = 64;
+    static constexpr size_t shards_per_thread = 4;
+
+    struct alignas(cache_line_size) Shard {
+        mutable std::shared_mutex mutex;
+        map_type map;
+        std::atomic<size_t> size{0};
+    };
+
+    [[ no_unique_address ]] Hash hash_func;
+    size_t num_shards;
+    std::unique_ptr<Shard[]> shards;
+
+    static size_t default_shard_count() {
+        return std::bit_ceil(std::max<size_t>(std::thread::hardware_concurrency(), 1) * shards_per_thread);
+    }
+
+    Shard& shard_for(const Key& key) const {
+        return shards[detail::mul_high(detail::hash_mix(hash_func(key)), num_shards)];
+    }
+
+    static void update_size(Shard& shard) {
+        shard.size.store(shard.map.size(), std::memory_order_relaxed);
+    }
+
+public:
+    explicit ShardedUnorderedMap(size_t shard_count = default_shard_count()) :
+            num_shards(std::max<size_t>(shard_count, 1)),
+            shards(std::make_unique<Shard[]>(this->num_shards)) {}
+
+    template <typename F>
+    bool visit(const Key& key, F&& func) const {
+        Shard& shard = shard_for(key);
+        std::shared_lock lock(shard.mutex);
+        auto it = std::as_const(shard.map).find(key);
+        if (it == shard.map.cend()) {
+            return false;
+        }
+        std::forward<F>(func)(*it);
+        return true;
+    }
+
+    template <typename F>
+    bool visit(const Key& key, F&& func) {
+        Shard& shard = shard_for(key);
+        std::unique_lock lock(shard.mutex);
+        auto it = shard.map.find(key);
+        if (it == shard.map.end()) {
+            return false;
+        }
+        std::forward<F>(func)(*it);
+        return true;
+    }
+
+    template <typename F>
+    void visit_all(F&& func) const {
+        for (size_t i = 0; i < num_shards; ++i) {
+            std::shared_lock lock(shards[i].mutex);
+            for (const auto& item : shards[i].map) {
+                func(item);
+            }
+        }
+    }
+
+    template <typename F>
+    void visit_all(F&& func) {
+        for (size_t i = 0; i < num_shards; ++i) {
+            std::unique_lock lock(shards[i].mutex);
+            for (auto& item : shards[i].map) {
+                func(item);
+            }
+        }
+    }
+
+    std::optional<Value> find(const Key& key) const {
+        std::optional<Value> result;
+        visit(key, [&result](const value_type& item) { result.emplace(item.second); });
+        return result;
+    }
+
+    bool contains(const Key& key) const {
+        Shard& shard = shard_for(key);
+        std::shared_lock lock(shard.mutex);
+        return shard.map.contains(key);
+    }
+
+    template <typename K, typename... Args>
+    bool emplace(K&& key, Args&&... args) {
+        Shard& shard = shard_for(key);
+        std::unique_lock lock(shard.mutex);
+        bool inserted = shard.map.try_emplace(std::forward<K>(key), std::forward<Args>(args)...).second;
+        update_size(shard);
+        return inserted;
+    }
+
+    template <typename K, typename M>
+    bool insert_or_assign(K&& key, M&& obj) {
+        Shard& shard = shard_for(key);
+        std::unique_lock lock(shard.mutex);
+        bool inserted = shard.map.insert_or_assign(std::forward<K>(key), std::forward<M>(obj)).second;
+        update_size(shard);
+        return inserted;
+    }
+
+    size_t erase(const Key& key) {
+        Shard& shard = shard_for(key);
+        std::unique_lock lock(shard.mutex);
+        size_t erased = shard.map.erase(key);
+        update_size(shard);
+        return erased;
+    }
+
+    size_t size() const {
+        size_t total = 0;
+        for (size_t i = 0; i < num_shards; ++i) {
+            total += shards[i].size.load(std::memory_order_relaxed);
+        }
+        return total;
+    }
+
+    bool empty() const {
+        return size() == 0;
+    }
+
+    size_t shard_count() const {
+        return num_shards;
+    }
+};
+
+namespace detail {
+
+class ThreadSlots {
+public:
+    static constexpr size_t max_threads = 256;
+
+    // max_threads once every slot is taken by a live thread
+    static size_t current() {
+        thread_local Handle handle;
+        return handle.index;
+    }
+
+private:
+    struct Handle {
+        size_t index = 0;
+
+        Handle() {
+            for (; index < max_threads; ++index) {
+                if (!used()[index].exchange(true, std::memory_order_acquire)) {
+                    return;
+                }
+            }
+        }
+
+        Handle(const Handle&) = delete;
+        Handle& operator=(const Handle&) = delete;
+
+        ~Handle() {
+            if (index < max_threads) {
+                used()[index].store(false, std::memory_order_release);
+            }
+        }
+    };
+
+    static std::array<std::atomic<bool>, max_threads>& used() {
+        static std::array<std::atomic<bool>, max_threads> slots{};
+        return slots;
+    }
+};
+
+class EpochDomain {
+public:
+    static constexpr uint64_t idle = std::numeric_limits<uint64_t>::max();
+
+private:
+    static constexpr size_t cache_line_size = 64;
+
+    struct alignas(cache_line_size) Slot {
+        std::atomic<uint64_t> epoch{idle};
+        size_t depth = 0;
+    };
+
+public:
+    class Guard {
+    public:
+        explicit Guard(const EpochDomain& domain) : slot(domain.slot_of(ThreadSlots::current())) {
+            if (slot && slot->depth++ == 0) {
+                slot->epoch.store(domain.global_epoch.load(std::memory_order_acquire), std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+            }
+        }
+
+        Guard(const Guard&) = delete;
+        Guard& operator=(const Guard&) = delete;
+
+        ~Guard() {
+            if (slot && --slot->depth == 0) {
+                slot->epoch.store(idle, std::memory_order_release);
+            }
+        }
+
+        // false when the thread got no slot; nothing it reads is protected then
+        bool pinned() const {
+            return slot != nullptr;
+        }
+
+    private:
+        Slot* slot;
+    };
+
+    EpochDomain() : slots(std::make_unique<Slot[]>(ThreadSlots::max_threads)) {}
+
+    Guard pin() const {
+        return Guard(*this);
+    }
+
+    uint64_t retire_epoch() {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        return global_epoch.fetch_add(1, std::memory_order_seq_cst);
+    }
+
+    uint64_t min_active_epoch() const {
+        uint64_t result = idle;
+        for (size_t i = 0; i < ThreadSlots::max_threads; ++i) {
+            result = std::min(result, slots[i].epoch.load(std::memory_order_acquire));
+        }
+        return result;
+    }
+
+private:
+    Slot* slot_of(size_t index) const {
+        return index < ThreadSlots::max_threads ? &slots[index] : nullptr;
+    }
+
+    std::atomic<uint64_t> global_epoch{0};
+    std::unique_ptr<Slot[]> slots;
+};
+
+}  // namespace detail
+
+template <typename Key,
+        typename Value,
+        typename Hash = std::hash<Key>,
+        typename KeyEqual = std::equal_to<Key>,
+        typename Allocator = std::allocator<std::pair<const Key, Value>>>
+class ReadMostlyUnorderedMap {
+public:
+    using value_type = std::pair<const Key, Value>;
+    using key_type = Key;
+    using mapped_type = Value;
+    using size_type = size_t;
+    using hasher = Hash;
+    using key_equal = KeyEqual;
+    using allocator_type = Allocator;
+
+private:
+    // a node has one next pointer per table generation: growing relinks the nodes through the pointer
+    // the current table doesn't use, so readers still walking the current table are never redirected
+    struct Node {
+        template <typename... Args>
+        explicit Node(size_t hash, Args&&... args) : hash(hash), data(std::forward<Args>(args)...) {}
+
+        std::array<std::atomic<Node*>, 2> next{};
+        size_t hash;
+        value_type data;
+    };
+
+    struct Table {
+        PowerOfTwoBucketPolicy policy;
+        std::atomic<Node*>* buckets;
+        size_t generation;
+    };
+
+    using NodeAlloc = typename std::allocator_traits<Allocator>::template rebind_alloc<Node>;
+    using BucketAlloc = typename std::allocator_traits<Allocator>::template rebind_alloc<std::atomic<Node*>>;
+    using TableAlloc = typename std::allocator_traits<Allocator>::template rebind_alloc<Table>;
+
+    [[ no_unique_address ]] Hash hash_func;
+    [[ no_unique_address ]] KeyEqual cmp_equal;
+    [[ no_unique_address ]] NodeAlloc node_alloc;
+    [[ no_unique_address ]] BucketAlloc bucket_alloc;
+    [[ no_unique_address ]] TableAlloc table_alloc;
+
+    detail::EpochDomain domain;
+    std::atomic<Table*> table;
+    std::atomic<size_t> sz{0};
+    float max_load = 1.0;
+
+    mutable std::mutex writer_mutex;
+    std::vector<std::pair<uint64_t, Node*>> retired_nodes;
+    std::vector<std::pair<uint64_t, Table*>> retired_tables;
+
+    Table* create_table(size_t count, size_t generation) {
+        PowerOfTwoBucketPolicy policy(count);
+        count = policy.bucket_count();
+        std::atomic<Node*>* buckets = std::allocator_traits<BucketAlloc>::allocate(bucket_alloc, count);
+        for (size_t i = 0; i < count; ++i) {
+            std::allocator_traits<BucketAlloc>::construct(bucket_alloc, buckets + i, nullptr);
+        }
+        Table* result = nullptr;
+        try {
+            result = std::allocator_traits<TableAlloc>::allocate(table_alloc, 1);
+        } catch (...) {
+            std::allocator_traits<BucketAlloc>::deallocate(bucket_alloc, buckets, count);
+            throw;
+        }
+        std::allocator_traits<TableAlloc>::construct(table_alloc, result, Table{policy, buckets, generation});
+        return result;
+    }
+
+    void destroy_table(Table* victim, bool with_nodes) {
+        size_t count = victim->policy.bucket_count();
+        for (size_t i = 0; with_nodes && i < count; ++i) {
+            Node* it = victim->buckets[i].load(std::memory_order_relaxed);
+            while (it) {
+                destroy_node(std::exchange(it, next_of(victim, it).load(std::memory_order_relaxed)));
+            }
+        }
+        std::allocator_traits<BucketAlloc>::deallocate(bucket_alloc, victim->buckets, count);
+        std::allocator_traits<TableAlloc>::destroy(table_alloc, victim);
+        std::allocator_traits<TableAlloc>::deallocate(table_alloc, victim, 1);
+    }
+
+    template <typename... Args>
+    Node* create_node(size_t hash, Args&&... args) {
+        Node* node = std::allocator_traits<NodeAlloc>::allocate(node_alloc, 1);
+        try {
+            std::allocator_traits<NodeAlloc>::construct(node_alloc, node, hash, std::forward<Args>(args)...);
+        } catch (...) {
+            std::allocator_traits<NodeAlloc>::deallocate(node_alloc, node, 1);
+            throw;
+        }
+        return node;
+    }
+
+    void destroy_node(Node* node) {
+        std::allocator_traits<NodeAlloc>::destroy(node_alloc, node);
+        std::allocator_traits<NodeAlloc>::deallocate(node_alloc, node, 1);
+    }
+
+    std::atomic<Node*>& bucket_for(Table* current, size_t hash) const {
+        return current->buckets[current->policy.index(hash)];
+    }
+
+    static std::atomic<Node*>& next_of(Table* current, Node* node) {
+        return node->next[current->generation % 2];
+    }
+
+    template <typename K>
+    Node* find_node(Table* current, const K& key, size_t hash) const {
+        Node* it = bucket_for(current, hash).load(std::memory_order_acquire);
+        while (it && !(it->hash == hash && cmp_equal(it->data.first, key))) {
+            it = next_of(current, it).load(std::memory_order_acquire);
+        }
+        return it;
+    }
+
+    std::atomic<Node*>& link_to(Table* current, Node* node) {
+        std::atomic<Node*>* link = &bucket_for(current, node->hash);
+        while (link->load(std::memory_order_relaxed) != node) {
+            link = &next_of(current, link->load(std::memory_order_relaxed));
+        }
+        return *link;
+    }
+
+    void reclaim() {
+        uint64_t safe = domain.min_active_epoch();
+        auto expired = [safe](const auto& item) { return item.first < safe; };
+        for (auto& [epoch, node] : retired_nodes) {
+            if (epoch < safe) {
+                destroy_node(node);
+            }
+        }
+        std::erase_if(retired_nodes, expired);
+        for (auto& [epoch, victim] : retired_tables) {
+            if (epoch < safe) {
+                destroy_table(victim, false);
+            }
+        }
+        std::erase_if(retired_tables, expired);
+    }
+
+    // the bigger table links the same nodes through the other next pointer, which is free only once the
+    // previous table is reclaimed; while a reader still pins it, growth is put off to a later insertion
+    bool grow(Table* current) {
+        reclaim();
+        if (!retired_tables.empty()) {
+            return false;
+        }
+        retired_tables.reserve(1);
+        Table* bigger = create_table(2 * current->policy.bucket_count(), current->generation + 1);
+        for (size_t i = 0; i < current->policy.bucket_count(); ++i) {
+            for (Node* it = current->buckets[i].load(std::memory_order_relaxed); it;
+                 it = next_of(current, it).load(std::memory_order_relaxed)) {
+                std::atomic<Node*>& bucket = bucket_for(bigger, it->hash);
+                next_of(bigger, it).store(bucket.load(std::memory_order_relaxed), std::memory_order_relaxed);
+                bucket.store(it, std::memory_order_relaxed);
+            }
+        }
+        table.store(bigger, std::memory_order_release);
+        retired_tables.emplace_back(domain.retire_epoch(), current);
+        return true;
+    }
+
+    // the caller reserves room in retired_nodes before creating new_node, so nothing here throws
+    void replace_node(Table* current, Node* old_node, Node* new_node) {
+        next_of(current, new_node).store(next_of(current, old_node).load(std::memory_order_relaxed),
+                                         std::memory_order_relaxed);
+        link_to(current, old_node).store(new_node, std::memory_order_release);
+        retired_nodes.emplace_back(domain.retire_epoch(), old_node);
+    }
+
+    template <typename K, typename... Args>
+    bool insert_locked(K&& key, size_t hash, Args&&... args) {
+        Table* current = table.load(std::memory_order_relaxed);
+        size_t count = sz.load(std::memory_order_relaxed) + 1;
+        if (static_cast<float>(count) > max_load * static_cast<float>(current->policy.bucket_count()) &&
+            grow(current)) {
+            current = table.load(std::memory_order_relaxed);
+        }
+        Node* node = create_node(hash, std::piecewise_construct,
+                                 std::forward_as_tuple(std::forward<K>(key)),
+                                 std::forward_as_tuple(std::forward<Args>(args)...));
+        std::atomic<Node*>& bucket = bucket_for(current, hash);
+        next_of(current, node).store(bucket.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        bucket.store(node, std::memory_order_release);
+        sz.store(count, std::memory_order_relaxed);
+        reclaim();
+        return true;
+    }
+
+    // a thread beyond ThreadSlots::max_threads can't pin an epoch, so it copies the element
+    // under the writer lock and visits the copy after unlocking; an element that can't be copied
+    // is visited with the lock held instead
+    template <typename F>
+    bool visit_locked(const Key& key, F&& func) const {
+        std::optional<value_type> copy;
+        {
+            std::lock_guard lock(writer_mutex);
+            Node* node = find_node(table.load(std::memory_order_relaxed), key, hash_func(key));
+            if (!node) {
+                return false;
+            }
+            if constexpr (!std::is_copy_constructible_v<value_type>) {
+                std::forward<F>(func)(std::as_const(node->data));
+                return true;
+            } else {
+                copy.emplace(node->data);
+            }
+        }
+        std::forward<F>(func)(std::as_const(*copy));
+        return true;
+    }
+
+public:
+    ReadMostlyUnorderedMap() : ReadMostlyUnorderedMap(Allocator()) {}
+
+    explicit ReadMostlyUnorderedMap(const Allocator& alloc) : node_alloc(alloc),
+                                                              bucket_alloc(alloc),
+                                                              table_alloc(alloc),
+                                                              table(create_table(1, 0)) {}
+
+    ReadMostlyUnorderedMap(const ReadMostlyUnorderedMap&) = delete;
+    ReadMostlyUnorderedMap& operator=(const ReadMostlyUnorderedMap&) = delete;
+
+    template <typename F>
+    bool visit(const Key& key, F&& func) const {
+        auto guard = domain.pin();
+        if (!guard.pinned()) {
+            return visit_locked(key, std::forward<F>(func));
+        }
+        size_t hash = hash_func(key);
+        Node* node = find_node(table.load(std::memory_order_acquire), key, hash);
+        if (!node) {
+            return false;
+        }
+        std::forward<F>(func)(std::as_const(node->data));
+        return true;
+    }
+
+    std::optional<Value> find(const Key& key) const {
+        std::optional<Value> result;
+        visit(key, [&result](const value_type& item) { result.emplace(item.second); });
+        return result;
+    }
+
+    bool contains(const Key& key) const {
+        return visit(key, [](const value_type&) {});
+    }
+
+    template <typename K, typename... Args>
+    bool emplace(K&& key, Args&&... args) {
+        std::lock_guard lock(writer_mutex);
+        size_t hash = hash_func(key);
+        if (find_node(table.load(std::memory_order_relaxed), key, hash)) {
+            return false;
+        }
+        return insert_locked(std::forward<K>(key), hash, std::forward<Args>(args)...);
+    }
+
+    template <typename K, typename M>
+    bool insert_or_assign(K&& key, M&& obj) {
+        std::lock_guard lock(writer_mutex);
+        size_t hash = hash_func(key);
+        Table* current = table.load(std::memory_order_relaxed);
+        Node* old_node = find_node(current, key, hash);
+        if (!old_node) {
+            return insert_locked(std::forward<K>(key), hash, std::forward<M>(obj));
+        }
+        retired_nodes.reserve(retired_nodes.size() + 1);
+        replace_node(current, old_node, create_node(hash, old_node->data.first, std::forward<M>(obj)));
+        reclaim();
+        return false;
+    }
+
+    size_t erase(const Key& key) {
+        std::lock_guard lock(writer_mutex);
+        size_t hash = hash_func(key);
+        Table* current = table.load(std::memory_order_relaxed);
+        Node* node = find_node(current, key, hash);
+        if (!node) {
+            return 0;
+        }
+        retired_nodes.reserve(retired_nodes.size() + 1);
+        link_to(current, node).store(next_of(current, node).load(std::memory_order_relaxed),
+                                     std::memory_order_release);
+        retired_nodes.emplace_back(domain.retire_epoch(), node);
+        sz.store(sz.load(std::memory_order_relaxed) - 1, std::memory_order_relaxed);
+        reclaim();
+        return 1;
+    }
+
+    size_t size() const {
+        return sz.load(std::memory_order_relaxed);
+    }
+
+    bool empty() const {
+        return size() == 0;
+    }
+
+    ~ReadMostlyUnorderedMap() {
+        for (auto& [epoch, node] : retired_nodes) {
+            destroy_node(node);
+        }
+        for (auto& [epoch, victim] : retired_tables) {
+            destroy_table(victim, false);
+        }
+        destroy_table(table.load(std::memory_order_relaxed), true);
     }
 };